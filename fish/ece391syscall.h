@@ -20,5 +20,11 @@ extern int32_t ece391_close (int32_t fd);
 extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 
+/*
+ * Grow the heap by increment bytes (shrink it if negative) and return
+ * where the new memory starts, or (void*)-1 on failure.
+ */
+extern void* ece391_sbrk (int32_t increment);
+
 #endif /* ECE391SYSCALL_H */
 
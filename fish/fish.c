@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include "ece391support.h"
 #include "ece391syscall.h"
+#include "ece391malloc.h"
 #include "blink.h"
 
 #define NULL 0
@@ -18,15 +19,11 @@ uint8_t file1[] = "frame1.txt";
 extern int mp1_ioctl(unsigned long arg, unsigned long cmd);
 extern void mp1_rtc_tasklet(unsigned long trash);
 
-static struct mp1_blink_struct blink_array[80*25];
-
 int main(void)
 {
     int rtc_fd, ret_val, i, garbage;
     struct mp1_blink_struct blink_struct;
 
-    ece391_memset(blink_array, 0, sizeof(struct mp1_blink_struct)*80*25);
-
     if(mp1_set_video_mode() == NULL) {
         return -1;
     }
@@ -160,19 +157,12 @@ mp1_set_video_mode (void)
 
 void* mp1_malloc(int32_t size)
 {
-    int32_t i;
-    for(i=0; i< 80*25; i++) {
-        if(blink_array[i].location == 0) {
-            return &blink_array[i];
-        }
-    }
-
-    return NULL;
+    return ece391_malloc(size);
 }
 
 void mp1_free(void* memory)
 {
-    ece391_memset(memory, 0, sizeof(struct mp1_blink_struct));
+    ece391_free(memory);
 }
 
 void ece391_memset(void* memory, char c, int n)
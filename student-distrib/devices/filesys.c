@@ -11,6 +11,15 @@ static uint32_t fs_data_start_addr;
 static boot_block_t* boot_block;
 static fs_stats_t* fs_stats;
 
+/*
+ * Open-addressed hash table over boot_block->entries, built by fs_init. Each
+ * slot holds a dentry index plus one, so 0 marks an empty slot.
+ */
+static uint8_t fs_name_index[FS_INDEX_SIZE];
+
+// Counters for read_dentry_by_name, reported by fs_print_index_stats
+static fs_index_stats_t fs_index_stats;
+
 // Declared in tasks.c
 extern file_desc_t kernel_file_array[FILE_ARRAY_SIZE];
 
@@ -28,6 +37,57 @@ void fs_init(uint32_t fs_start_addr_p) {
 
     fs_inode_start_addr = fs_start_addr + FS_BLOCK_SIZE;
     fs_data_start_addr = fs_inode_start_addr + (fs_stats->num_inodes * FS_BLOCK_SIZE);
+
+    fs_build_name_index();
+}
+
+/*
+ * fs_name_hash(const uint8_t* fname)
+ * Decsription: FNV-1a hash of a file name, over the same characters that
+ *              read_dentry_by_name compares (up to a NULL or FS_FNAME_LEN - 1)
+ * Inputs: fname - file name
+ * Outputs: hash value
+ */
+static uint32_t fs_name_hash(const uint8_t* fname) {
+    uint32_t hash = 2166136261U;
+
+    uint32_t i;
+    for(i = 0; i < FS_FNAME_LEN - 1 && fname[i] != '\0'; i++) {
+        hash ^= fname[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/*
+ * fs_build_name_index()
+ * Decsription: Hashes every dentry in the boot block into fs_name_index
+ * Inputs: none
+ * Outputs: none
+ */
+void fs_build_name_index() {
+    memset(fs_name_index, 0x00, sizeof(fs_name_index));
+    memset(&fs_index_stats, 0x00, sizeof(fs_index_stats_t));
+
+    uint32_t i;
+    for(i = 0; i < fs_stats->num_dentries && i < FS_MAX_DENTRIES; i++) {
+        const uint8_t* fname = (uint8_t*) boot_block->entries[i].fname;
+        uint32_t slot = fs_name_hash(fname) & (FS_INDEX_SIZE - 1);
+
+        while(fs_name_index[slot] != 0) {
+            // Keep the first of any duplicate names, as the linear scan did
+            dentry_t* other = &(boot_block->entries[fs_name_index[slot] - 1]);
+            if(strncmp(other->fname, (int8_t*) fname, FS_FNAME_LEN - 1) == 0) {
+                break;
+            }
+            slot = (slot + 1) & (FS_INDEX_SIZE - 1);
+        }
+
+        if(fs_name_index[slot] == 0) {
+            fs_name_index[slot] = i + 1;
+        }
+    }
 }
 
 /*
@@ -129,18 +189,25 @@ int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry) {
         return -1;
     }
 
-    uint8_t i;
-    for(i = 0; i < fs_stats->num_dentries; i++) {
-        dentry_t entry;
-        read_dentry_by_index(i, &entry);
+    uint64_t start = rdtsc();
+    fs_index_stats.lookups++;
+
+    uint32_t slot = fs_name_hash(fname) & (FS_INDEX_SIZE - 1);
+    while(fs_name_index[slot] != 0) {
+        dentry_t* entry = &(boot_block->entries[fs_name_index[slot] - 1]);
 
         // Subtract 1 from FS_FNAME_LEN for null-terminating byte
-        if(strncmp(entry.fname, (int8_t*) fname, FS_FNAME_LEN - 1) == 0) {
-            memcpy(dentry, &entry, sizeof(dentry_t));
+        if(strncmp(entry->fname, (int8_t*) fname, FS_FNAME_LEN - 1) == 0) {
+            memcpy(dentry, entry, sizeof(dentry_t));
+            fs_index_stats.hits++;
+            fs_index_stats.hit_cycles += (uint32_t) (rdtsc() - start);
             return 0;
         }
+
+        slot = (slot + 1) & (FS_INDEX_SIZE - 1);
     }
 
+    fs_index_stats.misses++;
     log(WARN, "Not found", "read_dentry_by_name");
     return -1;
 }
@@ -157,11 +224,34 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry) {
         return -1;
     }
 
-    dentry_t entry = boot_block->entries[index];
-    memcpy(dentry, &entry, sizeof(dentry_t));
+    memcpy(dentry, &(boot_block->entries[index]), sizeof(dentry_t));
     return 0;
 }
 
+/*
+ * fs_get_index_stats(fs_index_stats_t* stats)
+ * Decsription: Copies out the read_dentry_by_name counters
+ * Inputs: stats - struct to copy the counters into
+ * Outputs: none
+ */
+void fs_get_index_stats(fs_index_stats_t* stats) {
+    memcpy(stats, &fs_index_stats, sizeof(fs_index_stats_t));
+}
+
+/*
+ * fs_print_index_stats()
+ * Decsription: Prints the lookup counts and average hit latency of the name index
+ * Inputs: none
+ * Outputs: none
+ */
+void fs_print_index_stats() {
+    uint32_t avg = (fs_index_stats.hits == 0) ? 0 :
+        fs_index_stats.hit_cycles / fs_index_stats.hits;
+
+    printf("dentry lookups: %u, hits: %u, misses: %u, avg hit: %u cycles\n",
+            fs_index_stats.lookups, fs_index_stats.hits, fs_index_stats.misses, avg);
+}
+
 /*
  * read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
  * Decsription: Read data from from the file with inode index
@@ -179,13 +269,29 @@ int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length
     uint32_t bytes_left = node->length - offset;
     bytes_left = bytes_left > length ? length : bytes_left;
 
+    /*
+     * Walk the inode one data block at a time. Only the first block can start
+     * part-way in and only the last one can end early; everything in between
+     * is a whole-block copy.
+     */
+    uint32_t block_index = offset / FS_BLOCK_SIZE;
+    uint32_t block_offset = offset % FS_BLOCK_SIZE;
+
     uint32_t bytes_read = 0;
     while(bytes_read < bytes_left) {
-        uint32_t block_index = ((offset + bytes_read) / FS_BLOCK_SIZE);
         uint8_t* data_block_ptr = (uint8_t*) (fs_data_start_addr +
                 (node->blocks[block_index] * FS_BLOCK_SIZE));
-        buf[bytes_read] = data_block_ptr[(offset + bytes_read) % FS_BLOCK_SIZE];
-        bytes_read++;
+
+        uint32_t span = FS_BLOCK_SIZE - block_offset;
+        if(span > bytes_left - bytes_read) {
+            span = bytes_left - bytes_read;
+        }
+
+        memcpy(buf + bytes_read, data_block_ptr + block_offset, span);
+        bytes_read += span;
+
+        block_index++;
+        block_offset = 0;
     }
 
     return bytes_read;
@@ -209,6 +315,44 @@ int32_t fs_len(int32_t fd) {
     return node->length;
 }
 
+/*
+ * fs_inode_length(uint32_t inode)
+ * Decsription: Get the length of the file with inode index
+ * Inputs: inode - inode index
+ * Outputs: length in bytes
+ */
+uint32_t fs_inode_length(uint32_t inode) {
+    inode_t* node = (inode_t*) (fs_inode_start_addr + inode * FS_BLOCK_SIZE);
+    return node->length;
+}
+
+/*
+ * fs_get_data_block(uint32_t inode, uint32_t block_index)
+ * Decsription: Finds where a block of a file lives inside the filesystem image
+ * Inputs: inode - inode index, block_index - index of the block within the file
+ * Outputs: NULL if the block is past the end of the file, its address otherwise
+ */
+void* fs_get_data_block(uint32_t inode, uint32_t block_index) {
+    inode_t* node = (inode_t*) (fs_inode_start_addr + inode * FS_BLOCK_SIZE);
+
+    if(block_index * FS_BLOCK_SIZE >= node->length) {
+        return NULL;
+    }
+
+    return (void*) (fs_data_start_addr + (node->blocks[block_index] * FS_BLOCK_SIZE));
+}
+
+/*
+ * fs_blocks_page_aligned()
+ * Decsription: Checks whether the data blocks of the image sit on page boundaries,
+ *              meaning each one can be mapped as a 4KB page on its own
+ * Inputs: none
+ * Outputs: 1 if they are aligned, 0 otherwise
+ */
+int32_t fs_blocks_page_aligned() {
+    return (fs_data_start_addr & (FOUR_KB - 1)) == 0;
+}
+
 /*
  * fs_seek(int32_t fd, uint32_t pos)
  * Decsription: Seek
@@ -263,3 +407,111 @@ void fs_test() {
     cli();
     while(1);
 }
+
+/*
+ * read_data_bytewise(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
+ * Decsription: Reference byte-at-a-time copy of read_data, used by fs_bench
+ * Inputs: inode - inode index, offset - offset, buf - buffer to copy data into, length, number of bytes to read
+ * Outputs: number of bytes read
+ */
+static int32_t read_data_bytewise(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length) {
+    inode_t* node = (inode_t*) (fs_inode_start_addr + inode * FS_BLOCK_SIZE);
+
+    if(offset >= node->length) {
+        return 0;
+    }
+
+    uint32_t bytes_left = node->length - offset;
+    bytes_left = bytes_left > length ? length : bytes_left;
+
+    uint32_t bytes_read = 0;
+    while(bytes_read < bytes_left) {
+        uint32_t block_index = ((offset + bytes_read) / FS_BLOCK_SIZE);
+        uint8_t* data_block_ptr = (uint8_t*) (fs_data_start_addr +
+                (node->blocks[block_index] * FS_BLOCK_SIZE));
+        buf[bytes_read] = data_block_ptr[(offset + bytes_read) % FS_BLOCK_SIZE];
+        bytes_read++;
+    }
+
+    return bytes_read;
+}
+
+/*
+ * fs_bench()
+ * Decsription: Reads every regular file in the filesystem with read_data and
+ *              with the byte-at-a-time reference loop, checks that both agree
+ *              and prints the rdtsc cycle counts for each
+ * Inputs: none
+ * Outputs: none
+ */
+void fs_bench() {
+    static uint8_t fast_buf[FS_BENCH_CHUNK];
+    static uint8_t ref_buf[FS_BENCH_CHUNK];
+
+    uint32_t total_bytes = 0;
+    uint32_t total_fast = 0;
+    uint32_t total_ref = 0;
+
+    uint32_t i;
+    for(i = 0; i < fs_stats->num_dentries; i++) {
+        dentry_t* entry = &(boot_block->entries[i]);
+        if(entry->type != FS_TYPE_FILE) {
+            continue;
+        }
+
+        uint32_t fast_cycles = 0;
+        uint32_t ref_cycles = 0;
+        uint32_t offset = 0;
+        int32_t fast_read;
+        do {
+            uint64_t start = rdtsc();
+            fast_read = read_data(entry->inode_num, offset, fast_buf, FS_BENCH_CHUNK);
+            uint64_t mid = rdtsc();
+            int32_t ref_read = read_data_bytewise(entry->inode_num, offset, ref_buf, FS_BENCH_CHUNK);
+            uint64_t end = rdtsc();
+
+            fast_cycles += (uint32_t) (mid - start);
+            ref_cycles += (uint32_t) (end - mid);
+
+            int32_t j;
+            for(j = 0; j < fast_read; j++) {
+                if(fast_buf[j] != ref_buf[j]) {
+                    break;
+                }
+            }
+            if(fast_read != ref_read || j != fast_read) {
+                log(ERROR, "read_data disagrees with the reference copy", "fs_bench");
+                return;
+            }
+
+            offset += fast_read;
+        } while(fast_read > 0);
+
+        int8_t name[FS_FNAME_LEN + 1];
+        memcpy(name, entry->fname, FS_FNAME_LEN);
+        name[FS_FNAME_LEN] = '\0';
+        printf("%s: %u bytes, %u / %u cycles\n", name, offset, fast_cycles, ref_cycles);
+
+        total_bytes += offset;
+        total_fast += fast_cycles;
+        total_ref += ref_cycles;
+    }
+
+    printf("total: %u bytes, %u / %u cycles\n", total_bytes, total_fast, total_ref);
+}
+
+// File operations of directories
+const file_ops_t fs_dir_ops = {
+    .read = fs_dir_read,
+    .write = fs_write,
+    .open = fs_open,
+    .close = fs_close
+};
+
+// File operations of regular files
+const file_ops_t fs_file_ops = {
+    .read = fs_read,
+    .write = fs_write,
+    .open = fs_open,
+    .close = fs_close
+};
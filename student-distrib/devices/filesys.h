@@ -14,6 +14,15 @@
 #define FS_BLOCK_SIZE 4096
 #define FS_FNAME_LEN  32
 
+// Dentries that fit in the boot block
+#define FS_MAX_DENTRIES 63
+
+// Slots in the name index hash table (power of two, at least 2x FS_MAX_DENTRIES)
+#define FS_INDEX_SIZE 128
+
+// Bytes handed to read_data per call by fs_bench
+#define FS_BENCH_CHUNK (8 * FS_BLOCK_SIZE)
+
 #define FS_TYPE_RTC  0
 #define FS_TYPE_DIR  1
 #define FS_TYPE_FILE 2
@@ -43,12 +52,23 @@ typedef struct {
 // Struct for filesys boot block
 typedef struct {
     fs_stats_t stats;
-    dentry_t entries[63];
+    dentry_t entries[FS_MAX_DENTRIES];
 } boot_block_t;
 
+// Counters kept by read_dentry_by_name
+typedef struct {
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t hit_cycles; // Total rdtsc cycles spent on successful lookups
+} fs_index_stats_t;
+
 // initialize the file system
 void fs_init(uint32_t fs_start_addr);
 
+// build the hashed name index over the boot block dentries
+void fs_build_name_index();
+
 // open
 int32_t fs_open(const uint8_t* fname);
 
@@ -70,16 +90,34 @@ int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
 // read dentry using the index
 int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
 
+// copy out the name index counters
+void fs_get_index_stats(fs_index_stats_t* stats);
+
+// print the name index counters
+void fs_print_index_stats();
+
 // read data
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
 
 // length
 int32_t fs_len(int32_t fd);
 
+// length of the file with inode index
+uint32_t fs_inode_length(uint32_t inode);
+
+// address of a file's data block inside the image
+void* fs_get_data_block(uint32_t inode, uint32_t block_index);
+
+// whether data blocks can be mapped directly as pages
+int32_t fs_blocks_page_aligned();
+
 // seek
 int32_t fs_seek(int32_t fd, uint32_t pos);
 
 // test file system
 void fs_test();
 
+// benchmark read_data against a byte-at-a-time copy
+void fs_bench();
+
 #endif /* _FILESYS_H */
@@ -4,6 +4,12 @@
 #include "../interrupts/interrupts.h"
 #include "../types.h"
 
+// Tasks asleep in rtc_read until their next virtual tick
+wait_queue_t rtc_wait_queue;
+
+// Hardware tick the earliest sleeper is waiting for (only valid while the queue isn't empty)
+volatile uint32_t rtc_next_wakeup;
+
 /**
  * Initializes the RTC
  * INPUTS: none
@@ -11,8 +17,8 @@
  * RETURNS: 0 on success
  */
 int32_t rtc_init() {
-    // Set default frequency
-    rtc_set_frequency(2);
+    // Run the hardware as fast as possible. Each file divides it down to its own frequency
+    rtc_set_frequency(MAX_FREQ);
 
     disable_inits(); // Disable interupts to keep RTC from entering an undefined state
 
@@ -25,6 +31,7 @@ int32_t rtc_init() {
     enable_inits(); // Enable interrupts again
 
     tick_counter = 0;
+    wait_queue_init(&rtc_wait_queue);
 
     return 0;
 }
@@ -36,8 +43,7 @@ int32_t rtc_init() {
  * RETURNS: 0 on success
  */
 int32_t rtc_set_frequency(int32_t freq) {
-    // Test if valid frequency. Uses clever trick for power of 2 from: http://stackoverflow.com/questions/600293/how-to-check-if-a-number-is-a-power-of-2
-    if(freq < MIN_FREQ || freq > MAX_FREQ || (freq & (freq - 1))) {
+    if(!rtc_valid_frequency(freq)) {
         return -1;
     }
 
@@ -57,6 +63,17 @@ int32_t rtc_set_frequency(int32_t freq) {
     return 0;
 }
 
+/**
+ * Checks whether the RTC can tick at a frequency
+ * INPUTS: freq - the frequency to check
+ * OUTPUTS: none
+ * RETURNS: 1 if valid, 0 otherwise
+ */
+int32_t rtc_valid_frequency(int32_t freq) {
+    // Test if valid frequency. Uses clever trick for power of 2 from: http://stackoverflow.com/questions/600293/how-to-check-if-a-number-is-a-power-of-2
+    return !(freq < MIN_FREQ || freq > MAX_FREQ || (freq & (freq - 1)));
+}
+
 /**
  * Open - does nothing now
  * INPUTS: filename - name of the file
@@ -68,34 +85,55 @@ int32_t rtc_open(const uint8_t* filename) {
 }
 
 /**
- * Close - resets the frequency
+ * Close - does nothing, as the frequency belonged to the closed file alone
  * INPUTS: fd - garbage
  * OUTPUTS: none
  * RETURNS: 0 on success
  */
 int32_t rtc_close(int32_t fd) {
-    // Reset frequency to 2
-    rtc_set_frequency(2);
     return 0;
 }
 
 /**
- * Read
- * INPUTS: fd, buf, nbytes - all garbage
+ * Read - waits for the next tick at the file's frequency. Virtual ticks fall
+ * on multiples of the file's interval, like the interrupts of a real RTC
+ * running at that frequency would
+ * INPUTS: fd - RTC file descriptor, buf, nbytes - garbage
  * OUTPUTS: none
  * RETURNS: 0 on success
  */
 int32_t rtc_read(int32_t fd, void* buf, int32_t nbytes) {
-    uint32_t current_ticks = tick_counter;
+    uint32_t interval = get_file_array()[fd].rtc_interval;
+    if(interval == 0) {
+        // Not opened as an RTC file (e.g. kernel test code calling in directly)
+        interval = RTC_INTERVAL(RTC_DEFAULT_FREQ);
+    }
 
-    // spin until interrupt
-    while(current_ticks == tick_counter);
+    cli();
+    uint32_t target = (tick_counter / interval + 1) * interval;
+
+    if(get_pcb_ptr() == NULL) {
+        // The pre-shell kernel can't sleep, so spin until the tick
+        sti();
+        while((int32_t) (tick_counter - target) < 0);
+        return 0;
+    }
+
+    // Sleep until the tick, telling rtc_isr how soon that is
+    while((int32_t) (tick_counter - target) < 0) {
+        if(rtc_wait_queue.head == NULL || (int32_t) (target - rtc_next_wakeup) < 0) {
+            rtc_next_wakeup = target;
+        }
+        task_sleep(&rtc_wait_queue);
+    }
+
+    sti();
     return 0;
 }
 
 /**
- * Write the new frequency to the rtc
- * INPUTS: rfd - garbage, buf - data, nbytes - size of data
+ * Write the file's new frequency. The hardware is left alone
+ * INPUTS: fd - RTC file descriptor, buf - data, nbytes - size of data
  * OUTPUTS: none
  * RETURNS: 0 on success, -1 on failure
  */
@@ -122,6 +160,18 @@ int32_t rtc_write(int32_t fd, const void* buf, int32_t nbytes) {
             return -1;
     }
 
-    return rtc_set_frequency(frequency);
+    if(!rtc_valid_frequency(frequency)) {
+        return -1;
+    }
+
+    get_file_array()[fd].rtc_interval = RTC_INTERVAL(frequency);
+    return 0;
 }
 
+// File operations of the RTC device file
+const file_ops_t rtc_ops = {
+    .read = rtc_read,
+    .write = rtc_write,
+    .open = rtc_open,
+    .close = rtc_close
+};
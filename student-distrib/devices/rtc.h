@@ -14,24 +14,39 @@
 #define MIN_FREQ 2
 #define MAX_FREQ 1024
 
+// Virtual frequency of a newly opened RTC file
+#define RTC_DEFAULT_FREQ 2
+
+// Hardware ticks per virtual tick at a frequency. The hardware always runs at MAX_FREQ
+#define RTC_INTERVAL(freq) (MAX_FREQ / (freq))
+
 volatile uint32_t tick_counter;
 
+// Tasks waiting for their next virtual RTC tick
+extern wait_queue_t rtc_wait_queue;
+
+// Hardware tick the earliest task on rtc_wait_queue is waiting for
+extern volatile uint32_t rtc_next_wakeup;
+
 // initializes the RTC
 int32_t rtc_init();
 
-// resets the frequency to the default
+// sets the hardware frequency
 int32_t rtc_set_frequency(int32_t freq);
 
+// checks whether a virtual frequency is supported
+int32_t rtc_valid_frequency(int32_t freq);
+
 // dodes nothing
 int32_t rtc_open(const uint8_t* filename);
 
-// 
+// does nothing, other files keep their own frequency
 int32_t rtc_close(int32_t fd);
 
-// read the frequency
+// wait for the next tick at the file's frequency
 int32_t rtc_read(int32_t fd, void* buf, int32_t nbytes);
 
-// write the new frequency
+// write the file's new frequency
 int32_t rtc_write(int32_t fd, const void* buf, int32_t nbytes);
 
 #endif
@@ -3,21 +3,16 @@
  * vim:ts=4 expandtab
  */
 #include "terminal.h"
+#include "../interrupts/syscalls.h"
 
 #define NUM_COLS 80
 #define NUM_ROWS 25
 
-// Holds the current line of input
-static uint8_t keyboard_buffers[NUM_TERMINALS][KEYBOARD_BUFFER_SIZE];
+// Typed input of each terminal, lines waiting to be read and the one being typed
+static input_ring_t input_rings[NUM_TERMINALS];
 
-// Holds a copy of the previous line of input (after hitting enter)
-static uint8_t read_buffers[NUM_TERMINALS][KEYBOARD_BUFFER_SIZE];
-
-// Tracks the index of the next character to be inserted
-static uint32_t keyboard_buffer_indices[NUM_TERMINALS];
-
-// Indicates whether the read_buffer is ready to be read from
-static volatile uint8_t read_ready_flags[NUM_TERMINALS];
+// Tasks asleep in terminal_read until a line is entered
+static wait_queue_t read_wait_queues[NUM_TERMINALS];
 
 // Stores the pids for the main shell started when each terminal was first switched to
 volatile uint32_t shell_pids[NUM_TERMINALS];
@@ -28,10 +23,6 @@ volatile uint32_t active_pids[NUM_TERMINALS];
 // Stores the index of the current terminal
 volatile uint32_t current_terminal = 0;
 
-// Stores the screen position for each terminal between task switches
-volatile int switch_screen_pos_x[NUM_TERMINALS];
-volatile int switch_screen_pos_y[NUM_TERMINALS];
-
 /*
  * int32_t terminal_open(const uint8_t* filename)
  * Decsription: Opens a terminal
@@ -39,17 +30,13 @@ volatile int switch_screen_pos_y[NUM_TERMINALS];
  * Outputs: 0 on success
  */
 int32_t terminal_open(const uint8_t* filename) {
-    memset(keyboard_buffers, 0x00, sizeof(keyboard_buffers));
-    memset(read_buffers, 0x00, sizeof(read_buffers));
+    memset(input_rings, 0x00, sizeof(input_rings));
 
     int i;
     for(i = 0; i < NUM_TERMINALS; i++) {
-        keyboard_buffer_indices[i] = 0;
-        read_ready_flags[i] = 0;
+        wait_queue_init(&read_wait_queues[i]);
         shell_pids[i] = 0;
         active_pids[i] = 0;
-        switch_screen_pos_x[i] = 0;
-        switch_screen_pos_y[i] = 0;
     }
 
     return 0;
@@ -72,37 +59,39 @@ int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes) {
         log(ERROR, "Can't call terminal functions before starting shell", "terminal_read");
         return -1;
     }
-    uint32_t t_idx = pcb->terminal_index;
-
-    memset(read_buffers[t_idx], 0x00, sizeof(read_buffers[t_idx]));
+    input_ring_t* ring = &input_rings[pcb->terminal_index];
 
-    // Wait for read_ready to be set
-    uint32_t spin = 0;
-    while (!read_ready_flags[t_idx]) {
-        spin++;
+    // Sleep until a whole line is in, letting other tasks run meanwhile. The
+    // check and the sleep have to happen together so a wakeup isn't missed
+    if(ring->tail == ring->committed) {
+        cli();
+        while(ring->tail == ring->committed) {
+            task_sleep(&read_wait_queues[pcb->terminal_index]);
+        }
+        sti();
     }
 
-    int32_t bytes_to_read = (nbytes > KEYBOARD_BUFFER_SIZE) ?
-        KEYBOARD_BUFFER_SIZE : nbytes;
+    // Take bytes up to the end of the line. Whatever doesn't fit stays for the next read
+    uint32_t tail = ring->tail;
+    uint32_t end = ring->committed;
+    barrier(); // Don't read the line before seeing that it was committed
 
-    cli();
-    int i;
-    for(i = 0; i < bytes_to_read; i++) {
-        uint8_t next = read_buffers[t_idx][i];
-        ((uint8_t*) buf)[i] = next;
+    int32_t count = 0;
+    while(count < nbytes && tail != end) {
+        uint8_t next = ring->data[tail % INPUT_RING_SIZE];
+        ((uint8_t*) buf)[count++] = next;
+        tail++;
 
         // Stop returning bytes after encountering a newline
         if(next == '\n') {
-            read_ready_flags[t_idx] = 0;
-            sti();
-            return i + 1;
+            break;
         }
     }
 
-    read_ready_flags[t_idx] = 0;
-    sti();
+    barrier(); // Finish reading before handing the space back to the keyboard
+    ring->tail = tail;
 
-    return bytes_to_read;
+    return count;
 }
 
 /*
@@ -117,13 +106,10 @@ int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes) {
         return -1;
     }
 
-    int i;
-    for(i = 0; i < nbytes; i++) {
-        uint8_t next = ((uint8_t*) buf)[i];
-        putc(next);
-    }
-
-    return nbytes;
+    // Draw the whole buffer at once on the running task's terminal
+    pcb_t* pcb = get_pcb_ptr();
+    return write_terminal((pcb == NULL) ? current_terminal : pcb->terminal_index,
+            (const uint8_t*) buf, nbytes);
 }
 
 /*
@@ -144,46 +130,41 @@ int32_t terminal_close(int32_t fd) {
  * Outputs: -1 on failure, 0 on success
  */
 int32_t terminal_write_key(uint8_t key) {
-    pcb_t* pcb = get_pcb_ptr();
-    if(pcb == NULL) {
-        log(ERROR, "Can't call terminal functions before starting shell", "terminal_write_key");
-        return -1;
-    }
-    uint32_t t_idx = pcb->terminal_index;
+    // Keystrokes always go to the terminal on screen, whichever task is running
+    uint32_t t_idx = current_terminal;
+    input_ring_t* ring = &input_rings[t_idx];
+
+    // Typing brings a view scrolled back through the history back to the screen
+    scroll_view(t_idx, -SCROLLBACK_LINES);
 
-    // Handle backspace
+    // Handle backspace, which can only take back the line still being typed
     if(key == '\b') {
-        cli();
-        if(keyboard_buffer_indices[t_idx] > 0) {
-            putc('\b');
+        if(ring->head != ring->committed) {
+            ring->head--;
+            putc_terminal(t_idx, '\b');
         }
-        keyboard_buffer_indices[t_idx] = (keyboard_buffer_indices[t_idx] == 0) ? 0 :
-            keyboard_buffer_indices[t_idx] - 1;
-        keyboard_buffers[t_idx][keyboard_buffer_indices[t_idx]] = 0x00;
-        sti();
         return 0;
     }
 
-    // Handle enter
-    if(key == '\n') {
-        cli();
-        keyboard_buffers[t_idx][keyboard_buffer_indices[t_idx]] = '\n';
-        memcpy(read_buffers[t_idx], keyboard_buffers[t_idx], sizeof(keyboard_buffers[t_idx]));
-        memset(keyboard_buffers[t_idx], 0x00, KEYBOARD_BUFFER_SIZE);
-        keyboard_buffer_indices[t_idx] = 0;
-        putc('\n');
-        read_ready_flags[t_idx] = 1;
-        sti();
-        return 0;
+    // Drop the keystroke if the ring is full. Enter is still let through at
+    // the end of a maximum length line, but only if there is room for it
+    uint32_t line_length = ring->head - ring->committed;
+    if(ring->head - ring->tail >= INPUT_RING_SIZE ||
+            (key != '\n' && line_length == KEYBOARD_BUFFER_SIZE - 1)) {
+        return -1;
     }
 
-    // Save at least one character for the line feed
-    if(keyboard_buffer_indices[t_idx] == KEYBOARD_BUFFER_SIZE - 1) {
-        return -1;
+    ring->data[ring->head % INPUT_RING_SIZE] = key;
+    ring->head++;
+    putc_terminal(t_idx, key);
+
+    // Handle enter: hand the line to readers
+    if(key == '\n') {
+        barrier(); // The line has to be in the ring before readers can see it
+        ring->committed = ring->head;
+        wait_queue_wake_all(&read_wait_queues[t_idx]);
     }
 
-    keyboard_buffers[t_idx][keyboard_buffer_indices[t_idx]++] = key;
-    putc(key);
     return 0;
 }
 
@@ -194,72 +175,123 @@ int32_t terminal_write_key(uint8_t key) {
  * Outputs: none
  */
 void terminal_clear() {
-    pcb_t* pcb = get_pcb_ptr();
-    if(pcb == NULL) {
-        log(ERROR, "Can't call terminal functions before starting shell", "terminal_clear");
-        return;
-    }
-    uint32_t t_idx = pcb->terminal_index;
+    uint32_t t_idx = current_terminal;
 
-    // Will only clear the correct terminal due to video memory mapping
+    // Clears the terminal on screen
     clear();
 
-    memset(keyboard_buffers[t_idx], 0x00, sizeof(keyboard_buffers[t_idx]));
-    memset(read_buffers[t_idx], 0x00, sizeof(read_buffers[t_idx]));
-    keyboard_buffer_indices[t_idx] = 0;
-    read_ready_flags[t_idx] = 0;
-    switch_screen_pos_x[t_idx] = 0;
-    switch_screen_pos_y[t_idx] = 0;
+    // Throw away the line being typed. Lines already entered are still read
+    input_rings[t_idx].head = input_rings[t_idx].committed;
 
     set_cursor(0, 0);
 }
 
 /**
- * switch_active_terminal_screen(uint32_t old_pid, uint32_t new_pid)
- * Description: switches the active terminal
- * Inputs: old_pid - old terminal, new_pid - new terminal
+ * get_terminal_video_mem(uint32_t terminal)
+ * Description: finds the screen of a terminal. It stays in the same place
+ *              in VGA memory whether or not the terminal is on show
+ * Inputs: terminal - terminal index
+ * Outputs: the terminal's screen
+ */
+void* get_terminal_video_mem(uint32_t terminal) {
+    return (void*) TERMINAL_SCREEN(terminal);
+}
+
+/**
+ * switch_active_terminal_screen(uint32_t new_terminal)
+ * Description: puts another terminal on screen by pointing the VGA display
+ *              start address at its screen. Nothing is copied or remapped.
+ *              Interrupts must be disabled
+ * Inputs: new_terminal - terminal to show
  * Outputs: none
  */
-void switch_active_terminal_screen(uint32_t old_pid, uint32_t new_pid) {
-    if(old_pid == KERNEL_PID || new_pid == KERNEL_PID) {
-        log(WARN, "Can't switch terminal while in pre-shell kernel!", "switch_active_terminal_screen");
+void switch_active_terminal_screen(uint32_t new_terminal) {
+    if(current_terminal == new_terminal) {
+        log(DEBUG, "No use switching to the same terminal screen", "switch_active_terminal_screen");
         return;
     }
 
-    pcb_t* old_pcb = get_pcb_ptr_pid(old_pid);
-    pcb_t* new_pcb = get_pcb_ptr_pid(new_pid);
+    current_terminal = new_terminal;
 
-    uint32_t old_terminal = old_pcb->terminal_index;
-    uint32_t new_terminal = new_pcb->terminal_index;
+    uint16_t start = new_terminal * TERMINAL_SCREEN_CELLS;
+    outb(VGA_START_ADDR_HIGH, VGA_CRTC_INDEX);
+    outb((uint8_t) (start >> 8), VGA_CRTC_DATA);
+    outb(VGA_START_ADDR_LOW, VGA_CRTC_INDEX);
+    outb((uint8_t) (start & 0xFF), VGA_CRTC_DATA);
 
-    if(old_terminal == new_terminal) {
-        log(DEBUG, "No use switching to the same terminal screen", "switch_active_terminal_screen");
-        return;
-    }
+    // Reset the location of the cursor
+    reset_screen_pos();
+}
 
-    void* old_backing = (void*) (VIDEO + (FOUR_KB * (old_terminal + 1)));
-    void* new_backing = (void*) (VIDEO + (FOUR_KB * (new_terminal + 1)));
+/**
+ * terminal_switch(uint32_t terminal)
+ * Description: handles ALT-F{1,2,3}. Shows the terminal, starting its base
+ *              shell if it doesn't have one yet. Interrupts must be disabled
+ * Inputs: terminal - terminal index
+ * Outputs: none
+ */
+void terminal_switch(uint32_t terminal) {
+    switch_active_terminal_screen(terminal);
+
+    if(shell_pids[terminal] == 0) {
+        // Need to start a new shell for this terminal
+        pcb_t* shell = spawn_task((uint8_t*) "shell", terminal, KERNEL_PID);
+        if(shell != NULL) {
+            task_enqueue(shell);
+        }
+    }
+}
 
-    // Identity map pages for video memory backing stores
-    mmap_pid(new_pid, old_backing, old_backing, ACCESS_SUPER);
-    mmap_pid(new_pid, new_backing, new_backing, ACCESS_SUPER);
-    mmap_pid(new_pid, ((void*) VIDEO), ((void*) VIDEO), ACCESS_SUPER);
+// File operations of stdin and stdout
+const file_ops_t terminal_ops = {
+    .read = terminal_read,
+    .write = terminal_write,
+    .open = terminal_open,
+    .close = terminal_close
+};
 
-    // Copy video mem from VIDEO to backing for old_pid
-    memcpy(old_backing, ((void*) VIDEO), FOUR_KB);
+/*
+ * terminal_bench()
+ * Decsription: Cats TERMINAL_BENCH_FILE to the screen in TERMINAL_BENCH_CHUNK
+ *              sized writes, first with terminal_write and then a byte at a
+ *              time with putc as terminal_write used to, and prints the
+ *              throughput of each in bytes per thousand cycles
+ * Inputs: none
+ * Outputs: none
+ */
+void terminal_bench() {
+    static uint8_t buf[TERMINAL_BENCH_CHUNK];
 
-    // Save screen position
-    switch_screen_pos_x[old_terminal] = get_screen_x();
-    switch_screen_pos_y[old_terminal] = get_screen_y();
+    dentry_t dentry;
+    if(read_dentry_by_name((uint8_t*) TERMINAL_BENCH_FILE, &dentry) == -1) {
+        log(WARN, "Benchmark file not found", "terminal_bench");
+        return;
+    }
 
-    // Copy video mem from backing for new_pid to VIDEO
-    memcpy(((void*) VIDEO), new_backing, FOUR_KB);
+    uint32_t bulk_cycles = 0;
+    uint32_t putc_cycles = 0;
+    uint32_t total_bytes = 0;
+    uint32_t offset = 0;
+    int32_t count;
+    while((count = read_data(dentry.inode_num, offset, buf, TERMINAL_BENCH_CHUNK)) > 0) {
+        uint64_t start = rdtsc();
+        terminal_write(STDOUT_FD, buf, count);
+        uint64_t mid = rdtsc();
+        int32_t i;
+        for(i = 0; i < count; i++) {
+            putc(buf[i]);
+        }
+        uint64_t end = rdtsc();
 
-    // Reset the location of the cursor
-    reset_screen_pos();
+        bulk_cycles += (uint32_t) (mid - start);
+        putc_cycles += (uint32_t) (end - mid);
+        total_bytes += count;
+        offset += count;
+    }
 
-    // Unmap identity maped pages for video memory backing stores
-    munmap_pid(new_pid, old_backing);
-    munmap_pid(new_pid, new_backing);
+    printf("cat %s: %u bytes\n", TERMINAL_BENCH_FILE, total_bytes);
+    printf("terminal_write: %u cycles, %u bytes/kcycle\n", bulk_cycles,
+            total_bytes / (bulk_cycles / 1000 + 1));
+    printf("putc per byte: %u cycles, %u bytes/kcycle\n", putc_cycles,
+            total_bytes / (putc_cycles / 1000 + 1));
 }
-
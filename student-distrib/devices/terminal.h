@@ -6,13 +6,48 @@
 #define _TERMINAL_H
 
 #define NUM_TERMINALS 3
+// Longest line that can be typed, counting its newline
 #define KEYBOARD_BUFFER_SIZE 128
 
+// Bytes of typed input each terminal holds before keystrokes are dropped (a power of 2)
+#define INPUT_RING_SIZE 1024
+
+/*
+ * Every terminal has its own screen in VGA text memory, 4KB apart, and
+ * switching terminals only moves where the VGA starts displaying from
+ */
+#define TERMINAL_SCREEN(t)      (VIDEO + FOUR_KB * (t))
+#define TERMINAL_SCREEN_CELLS   (FOUR_KB / 2)
+
+// CRTC registers holding the display start address, in character cells
+#define VGA_CRTC_INDEX          0x3D4
+#define VGA_CRTC_DATA           0x3D5
+#define VGA_START_ADDR_HIGH     0x0C
+#define VGA_START_ADDR_LOW      0x0D
+
+// File terminal_bench cats to the screen, and how much it writes at once
+#define TERMINAL_BENCH_FILE  "verylargetxtwithverylongname.txt"
+#define TERMINAL_BENCH_CHUNK 1024
+
 #include "../types.h"
 #include "../log.h"
 #include "../lib.h"
 #include "../tasks.h"
 
+/*
+ * Typed input of a terminal. The keyboard interrupt is the only writer and
+ * the terminal's reader the only reader, so neither needs to lock out the
+ * other. Indices run freely and wrap with INPUT_RING_SIZE. Bytes from tail
+ * to committed are whole lines waiting to be read, and bytes from committed
+ * to head are the line still being typed, which backspace can take back
+ */
+typedef struct {
+    uint8_t data[INPUT_RING_SIZE];
+    volatile uint32_t head;      // Where the next keystroke goes. Only the keyboard interrupt changes it
+    volatile uint32_t committed; // End of the last line entered. Only the keyboard interrupt changes it
+    volatile uint32_t tail;      // Next byte to read. Only the reader changes it
+} input_ring_t;
+
 // open the terminal
 int32_t terminal_open(const uint8_t* filename);
 
@@ -31,7 +66,16 @@ int32_t terminal_write_key(uint8_t key);
 // clear the terminal
 void terminal_clear();
 
+// get the screen of a terminal in VGA memory
+void* get_terminal_video_mem(uint32_t terminal);
+
 // switch the active terminal
-void switch_active_terminal_screen(uint32_t old_pid, uint32_t new_pid);
+void switch_active_terminal_screen(uint32_t new_terminal);
+
+// switch to a terminal, starting its shell if needed
+void terminal_switch(uint32_t terminal);
+
+// time writing a large file to the screen in bulk and a byte at a time
+void terminal_bench();
 
 #endif /* TERMINAL_H */
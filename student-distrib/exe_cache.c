@@ -0,0 +1,290 @@
+/**
+ * exe_cache.c
+ *
+ * vim:ts=4 expandtab
+ */
+#include "exe_cache.h"
+#include "devices/filesys.h"
+#include "frames.h"
+#include "lib.h"
+#include "log.h"
+
+// Executables checked so far, looked up by inode
+static exe_cache_entry_t exe_cache[EXE_CACHE_ENTRIES];
+
+static exe_cache_stats_t exe_cache_stats = {0, 0, 0, 0, EXE_CACHE_BUDGET};
+
+// Goes up by one every lookup, so entries can tell how long ago they were used
+static uint32_t exe_cache_clock = 0;
+
+/*
+ * exe_cache_evict(exe_cache_entry_t* entry)
+ * Decsription: Drops an entry from the cache, giving its image copy back to
+ *              the frame allocator
+ * Inputs: entry - entry to empty
+ * Outputs: none
+ */
+static void exe_cache_evict(exe_cache_entry_t* entry) {
+    if(!entry->in_use) {
+        return;
+    }
+
+    if(entry->image != NULL) {
+        frame_free(entry->image, entry->image_frames);
+        exe_cache_stats.image_bytes -= entry->image_frames * FRAME_SIZE;
+    }
+
+    memset(entry, 0x00, sizeof(exe_cache_entry_t));
+    exe_cache_stats.evictions++;
+}
+
+/*
+ * exe_cache_lru(uint32_t with_image)
+ * Decsription: Finds the least recently used entry
+ * Inputs: with_image - 1 to only consider entries holding an image copy
+ * Outputs: the entry, or NULL if there are none to consider
+ */
+static exe_cache_entry_t* exe_cache_lru(uint32_t with_image) {
+    exe_cache_entry_t* lru = NULL;
+
+    int i;
+    for(i = 0; i < EXE_CACHE_ENTRIES; i++) {
+        exe_cache_entry_t* entry = &exe_cache[i];
+        if(!entry->in_use || (with_image && entry->image == NULL)) {
+            continue;
+        }
+        if(lru == NULL || entry->last_used < lru->last_used) {
+            lru = entry;
+        }
+    }
+    return lru;
+}
+
+/*
+ * exe_cache_read_phdrs(exe_cache_entry_t* entry)
+ * Decsription: Reads the program headers of an executable, which say which
+ *              pages the program writes to and so which can be mapped from
+ *              the filesystem image, and how far its segments reach. Leaves
+ *              num_phdrs 0 if they can't be used
+ * Inputs: entry - entry being filled in, with inode and length set
+ * Outputs: none
+ */
+static void exe_cache_read_phdrs(exe_cache_entry_t* entry) {
+    uint8_t header[ELF_HEADER_LEN];
+    if(read_data(entry->inode, 0, header, ELF_HEADER_LEN) != ELF_HEADER_LEN) {
+        return;
+    }
+
+    uint32_t phoff = *((uint32_t*) (header + ELF_PHOFF_OFFSET));
+    uint32_t phentsize = *((uint16_t*) (header + ELF_PHENTSIZE_OFFSET));
+    uint32_t num_phdrs = *((uint16_t*) (header + ELF_PHNUM_OFFSET));
+    if(phentsize != sizeof(elf_phdr_t) || num_phdrs == 0 || num_phdrs > ELF_MAX_PHDRS) {
+        return;
+    }
+
+    uint32_t phdrs_len = num_phdrs * sizeof(elf_phdr_t);
+    if(read_data(entry->inode, phoff, (uint8_t*) entry->phdrs, phdrs_len) != phdrs_len) {
+        return;
+    }
+
+    entry->num_phdrs = num_phdrs;
+}
+
+/*
+ * exe_cache_copy_image(exe_cache_entry_t* entry)
+ * Decsription: Keeps a copy of an image that can't be mapped from the
+ *              filesystem, evicting older copies to stay within the budget.
+ *              Leaves image NULL if it doesn't fit or memory is short
+ * Inputs: entry - entry being filled in, with inode and length set
+ * Outputs: none
+ */
+static void exe_cache_copy_image(exe_cache_entry_t* entry) {
+    uint32_t frames = (entry->length + FRAME_SIZE - 1) / FRAME_SIZE;
+    uint32_t bytes = frames * FRAME_SIZE;
+    if(frames == 0 || bytes > exe_cache_stats.budget) {
+        return;
+    }
+
+    while(exe_cache_stats.image_bytes + bytes > exe_cache_stats.budget) {
+        exe_cache_evict(exe_cache_lru(1));
+    }
+
+    uint8_t* image = frame_alloc(frames, 1);
+    if(image == NULL) {
+        return;
+    }
+
+    if(read_data(entry->inode, 0, image, entry->length) != entry->length) {
+        frame_free(image, frames);
+        return;
+    }
+
+    entry->image = image;
+    entry->image_frames = frames;
+    exe_cache_stats.image_bytes += bytes;
+}
+
+/*
+ * exe_cache_fill(exe_cache_entry_t* entry, uint32_t inode)
+ * Decsription: Checks an executable and records what loading it needs
+ * Inputs: entry - empty entry, inode - inode of the executable
+ * Outputs: none
+ */
+static void exe_cache_fill(exe_cache_entry_t* entry, uint32_t inode) {
+    entry->in_use = 1;
+    entry->inode = inode;
+    entry->length = fs_inode_length(inode);
+
+    // Read the executable file header
+    uint8_t header[EXE_HEADER_LEN];
+    memset(header, 0x00, EXE_HEADER_LEN);
+    if(read_data(inode, 0, header, EXE_HEADER_LEN) != EXE_HEADER_LEN) {
+        log(WARN, "Can't read executable header", "exe_cache_fill");
+        return;
+    }
+
+    // Check for presence of magic number in header
+    if(((uint32_t*) header)[EXE_HEADER_MAGICNUM_IDX] != EXE_HEADER_MAGIC) {
+        log(WARN, "Magic number not present", "exe_cache_fill");
+        return;
+    }
+
+    // The image has to fit in the program window above where it is loaded
+    if(entry->length > (USER_PAGE_VIRT + FOUR_MB) - EXE_LOAD_ADDR) {
+        log(WARN, "Executable too large", "exe_cache_fill");
+        return;
+    }
+
+    // Get code entry point from header
+    entry->entry_point = ((uint32_t*) header)[EXE_HEADER_ENTRY_IDX];
+    entry->executable = 1;
+
+    exe_cache_read_phdrs(entry);
+
+    // The heap goes past both the file and any segment (bss) reaching beyond it
+    uint32_t end = EXE_LOAD_ADDR + entry->length;
+    uint32_t segments_end = EXE_LOAD_ADDR;
+    uint32_t i;
+    for(i = 0; i < entry->num_phdrs; i++) {
+        elf_phdr_t* phdr = &(entry->phdrs[i]);
+        if(phdr->type != ELF_PT_LOAD) {
+            continue;
+        }
+        if(phdr->vaddr + phdr->memsz > segments_end) {
+            segments_end = phdr->vaddr + phdr->memsz;
+        }
+        if(phdr->vaddr + phdr->memsz > end && phdr->vaddr + phdr->memsz <= USER_PAGE_VIRT + FOUR_MB) {
+            end = phdr->vaddr + phdr->memsz;
+        }
+    }
+    entry->image_end = (end + FOUR_KB - 1) & ~(FOUR_KB - 1);
+
+    /*
+     * elfconvert writes each segment, bss included, where it goes in memory
+     * and leaves the program headers' file offsets as the linker set them,
+     * so a file ending right where its segments do is such an image
+     */
+    entry->flat = entry->num_phdrs == 0 || EXE_LOAD_ADDR + entry->length == segments_end;
+
+    entry->mappable = EXE_MAP_IMAGE && fs_blocks_page_aligned() && entry->num_phdrs != 0;
+    if(!entry->mappable) {
+        exe_cache_copy_image(entry);
+    }
+}
+
+/*
+ * exe_cache_lookup(uint32_t inode)
+ * Decsription: Finds what is known about an executable. On a miss the file
+ *              is checked and the result cached, replacing the least recently
+ *              used entry if the cache is full. Files that failed the checks
+ *              are cached too, with executable 0. The entry stays valid until
+ *              the next lookup. Interrupts must be disabled
+ * Inputs: inode - inode of the executable
+ * Outputs: the cache entry
+ */
+exe_cache_entry_t* exe_cache_lookup(uint32_t inode) {
+    exe_cache_clock++;
+
+    exe_cache_entry_t* free_entry = NULL;
+    int i;
+    for(i = 0; i < EXE_CACHE_ENTRIES; i++) {
+        exe_cache_entry_t* entry = &exe_cache[i];
+        if(!entry->in_use) {
+            if(free_entry == NULL) {
+                free_entry = entry;
+            }
+        } else if(entry->inode == inode) {
+            exe_cache_stats.hits++;
+            entry->last_used = exe_cache_clock;
+            return entry;
+        }
+    }
+
+    exe_cache_stats.misses++;
+    if(free_entry == NULL) {
+        free_entry = exe_cache_lru(0);
+        exe_cache_evict(free_entry);
+    }
+
+    exe_cache_fill(free_entry, inode);
+    free_entry->last_used = exe_cache_clock;
+    return free_entry;
+}
+
+/*
+ * exe_cache_find(uint32_t inode)
+ * Decsription: Looks for an executable in the cache without touching the
+ *              counters or the least recently used order
+ * Inputs: inode - inode of the executable
+ * Outputs: the cache entry, or NULL if the executable isn't cached
+ */
+exe_cache_entry_t* exe_cache_find(uint32_t inode) {
+    int i;
+    for(i = 0; i < EXE_CACHE_ENTRIES; i++) {
+        if(exe_cache[i].in_use && exe_cache[i].inode == inode) {
+            return &exe_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * exe_cache_set_budget(uint32_t bytes)
+ * Decsription: Changes how much memory image copies may take up, evicting
+ *              the least recently used entries with copies until they fit
+ * Inputs: bytes - new budget, 0 to not keep any copies
+ * Outputs: none
+ */
+void exe_cache_set_budget(uint32_t bytes) {
+    uint32_t flags;
+    cli_and_save(flags);
+
+    exe_cache_stats.budget = bytes;
+    while(exe_cache_stats.image_bytes > bytes) {
+        exe_cache_evict(exe_cache_lru(1));
+    }
+
+    restore_flags(flags);
+}
+
+/*
+ * exe_cache_get_stats(exe_cache_stats_t* stats)
+ * Decsription: Copies out the cache counters
+ * Inputs: stats - struct to copy the counters into
+ * Outputs: none
+ */
+void exe_cache_get_stats(exe_cache_stats_t* stats) {
+    memcpy(stats, &exe_cache_stats, sizeof(exe_cache_stats_t));
+}
+
+/*
+ * exe_cache_print_stats()
+ * Decsription: Prints the hit and miss counts of the executable cache
+ * Inputs: none
+ * Outputs: none
+ */
+void exe_cache_print_stats() {
+    printf("exe cache hits: %u, misses: %u, evictions: %u, images: %u/%u bytes\n",
+            exe_cache_stats.hits, exe_cache_stats.misses, exe_cache_stats.evictions,
+            exe_cache_stats.image_bytes, exe_cache_stats.budget);
+}
@@ -0,0 +1,62 @@
+/**
+ * exe_cache.h
+ *
+ * vim:ts=4 expandtab
+ */
+#ifndef EXE_CACHE_H
+#define EXE_CACHE_H
+
+#include "types.h"
+#include "interrupts/syscalls.h"
+
+// Executables whose headers are remembered at once
+#define EXE_CACHE_ENTRIES 16
+
+// Default bytes of frames the cache may keep image copies in
+#define EXE_CACHE_BUDGET (2 * MB)
+
+/*
+ * What the cache knows about one executable. The filesystem is read-only, so
+ * an entry never goes stale; it only leaves the cache when it is evicted
+ */
+typedef struct {
+    uint32_t in_use;
+    uint32_t inode;
+    uint32_t executable;  // 1 if the image passed the checks and can be run
+    uint32_t entry_point;
+    uint32_t length;
+    uint32_t num_phdrs;   // 0 if the program headers couldn't be read
+    elf_phdr_t phdrs[ELF_MAX_PHDRS];
+    uint32_t flat;        // 1 if the file is laid out like memory from EXE_LOAD_ADDR, as elfconvert writes it
+    uint32_t mappable;    // 1 if pages the program doesn't write can be mapped from the filesystem image
+    uint32_t image_end;   // Page after the last one the program is loaded into, where its heap starts
+    uint8_t* image;       // Pristine copy of the file, NULL if the image is mapped or read instead
+    uint32_t image_frames;
+    uint32_t last_used;   // Lookup count at the last hit, for evicting the least recently used
+} exe_cache_entry_t;
+
+// Counters kept by exe_cache_lookup
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t image_bytes; // Bytes of frames held by image copies
+    uint32_t budget;      // Most bytes image copies may hold
+} exe_cache_stats_t;
+
+// find the cached executable with an inode, checking and caching it on a miss
+exe_cache_entry_t* exe_cache_lookup(uint32_t inode);
+
+// find the cached executable with an inode, without counting or filling anything in
+exe_cache_entry_t* exe_cache_find(uint32_t inode);
+
+// change how much memory image copies may take, evicting copies over it
+void exe_cache_set_budget(uint32_t bytes);
+
+// copy out the cache counters
+void exe_cache_get_stats(exe_cache_stats_t* stats);
+
+// print the cache counters
+void exe_cache_print_stats();
+
+#endif /* EXE_CACHE_H */
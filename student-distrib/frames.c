@@ -0,0 +1,207 @@
+/**
+ * frames.c
+ *
+ * vim:ts=4 expandtab
+ */
+#include "frames.h"
+#include "lib.h"
+#include "log.h"
+
+/* Check if the bit BIT in FLAGS is set. */
+#define CHECK_FLAG(flags,bit)   ((flags) & (1 << (bit)))
+
+// Multiboot memory map type for RAM that is free to use
+#define MMAP_TYPE_AVAILABLE 1
+
+#define BITS_PER_WORD 32
+
+// One bit per physical frame: 1 if in use (or not RAM at all), 0 if free
+static uint32_t frame_bitmap[NUM_FRAMES / BITS_PER_WORD];
+
+// Number of frames whose bit is 0
+static uint32_t num_free_frames;
+
+/*
+ * frame_used(uint32_t frame)
+ * Decsription: Checks whether a frame is taken
+ * Inputs: frame - frame number
+ * Outputs: 1 if the frame is in use, 0 if it is free
+ */
+static inline uint32_t frame_used(uint32_t frame) {
+    return (frame_bitmap[frame / BITS_PER_WORD] >> (frame % BITS_PER_WORD)) & 0x1;
+}
+
+/*
+ * mark_frames(uint32_t first, uint32_t count, uint32_t used)
+ * Decsription: Marks a run of frames as used or free, keeping the free count up to date
+ * Inputs: first - first frame number, count - number of frames,
+ *         used - 1 to mark them used, 0 to mark them free
+ * Outputs: none
+ */
+static void mark_frames(uint32_t first, uint32_t count, uint32_t used) {
+    uint32_t frame;
+    for(frame = first; frame < first + count && frame < NUM_FRAMES; frame++) {
+        if(frame_used(frame) == used) {
+            continue;
+        }
+
+        frame_bitmap[frame / BITS_PER_WORD] ^= (1 << (frame % BITS_PER_WORD));
+        if(used) {
+            num_free_frames--;
+        } else {
+            num_free_frames++;
+        }
+    }
+}
+
+/*
+ * mark_range(uint32_t start, uint32_t end, uint32_t used)
+ * Decsription: Marks every frame the allocator may hand out in [start, end)
+ *              as used or free. Free ranges are shrunk to whole frames, used
+ *              ones grown to them
+ * Inputs: start, end - physical address range, used - 1 for used, 0 for free
+ * Outputs: none
+ */
+static void mark_range(uint32_t start, uint32_t end, uint32_t used) {
+    if(start < FRAMES_START) {
+        start = FRAMES_START;
+    }
+    if(end > FRAMES_END) {
+        end = FRAMES_END;
+    }
+    if(start >= end) {
+        return;
+    }
+
+    uint32_t first, last;
+    if(used) {
+        first = start / FRAME_SIZE;
+        last = (end + FRAME_SIZE - 1) / FRAME_SIZE;
+    } else {
+        first = (start + FRAME_SIZE - 1) / FRAME_SIZE;
+        last = end / FRAME_SIZE;
+    }
+
+    if(first < last) {
+        mark_frames(first, last - first, used);
+    }
+}
+
+/*
+ * init_frames(multiboot_info_t* mbi)
+ * Decsription: Sets up the frame allocator. Only RAM the boot loader reports
+ *              as available is handed out, and modules (the file system image)
+ *              are kept out of it. Must run before paging is enabled, as the
+ *              multiboot structures aren't mapped afterwards
+ * Inputs: mbi - multiboot information from the boot loader
+ * Outputs: none
+ */
+void init_frames(multiboot_info_t* mbi) {
+    // Start with everything in use, then free what is known to be RAM
+    memset(frame_bitmap, 0xFF, sizeof(frame_bitmap));
+    num_free_frames = 0;
+
+    if(CHECK_FLAG(mbi->flags, 6)) {
+        memory_map_t* mmap;
+        for(mmap = (memory_map_t*) mbi->mmap_addr;
+                (uint32_t) mmap < mbi->mmap_addr + mbi->mmap_length;
+                mmap = (memory_map_t*) ((uint32_t) mmap + mmap->size + sizeof(mmap->size))) {
+            // Memory above 4GB is out of reach anyway
+            if(mmap->type != MMAP_TYPE_AVAILABLE || mmap->base_addr_high != 0) {
+                continue;
+            }
+
+            uint32_t end = mmap->base_addr_low + mmap->length_low;
+            if(mmap->length_high != 0 || end < mmap->base_addr_low) {
+                end = 0xFFFFFFFF; // Runs past 4GB, clamp
+            }
+            mark_range(mmap->base_addr_low, end, 0);
+        }
+    } else if(CHECK_FLAG(mbi->flags, 0)) {
+        // No memory map, so fall back to the size of upper memory, which starts at 1MB
+        mark_range(MB, MB + (mbi->mem_upper * KB), 0);
+    } else {
+        log(ERROR, "Boot loader didn't report any memory", "init_frames");
+    }
+
+    // Don't hand out memory the boot loader put modules in
+    if(CHECK_FLAG(mbi->flags, 3)) {
+        module_t* mod = (module_t*) mbi->mods_addr;
+        uint32_t i;
+        for(i = 0; i < mbi->mods_count; i++, mod++) {
+            mark_range(mod->mod_start, mod->mod_end, 1);
+        }
+    }
+}
+
+/*
+ * frame_alloc(uint32_t count, uint32_t align)
+ * Decsription: Finds count contiguous free frames, with the first one on a
+ *              multiple of align frames, and marks them used. The frames are
+ *              identity mapped for the kernel but not cleared
+ * Inputs: count - number of frames, align - alignment in frames (a power of 2)
+ * Outputs: physical address of the first frame, or NULL if no run is free
+ */
+void* frame_alloc(uint32_t count, uint32_t align) {
+    if(count == 0 || align == 0 || (align & (align - 1))) {
+        log(WARN, "Invalid frame count or alignment", "frame_alloc");
+        return NULL;
+    }
+
+    uint32_t first = FRAMES_START / FRAME_SIZE;
+    first = (first + align - 1) & ~(align - 1);
+
+    while(first + count <= NUM_FRAMES) {
+        // Skip whole words of used frames quickly when looking for a single frame
+        if(count == 1 && frame_bitmap[first / BITS_PER_WORD] == 0xFFFFFFFF) {
+            first = (first / BITS_PER_WORD + 1) * BITS_PER_WORD;
+            first = (first + align - 1) & ~(align - 1);
+            continue;
+        }
+
+        uint32_t i;
+        for(i = 0; i < count; i++) {
+            if(frame_used(first + i)) {
+                break;
+            }
+        }
+
+        if(i == count) {
+            mark_frames(first, count, 1);
+            return (void*) (first * FRAME_SIZE);
+        }
+
+        // Try the next aligned start past the frame that was in use
+        first = (first + i + align) & ~(align - 1);
+    }
+
+    log(WARN, "Out of physical memory", "frame_alloc");
+    return NULL;
+}
+
+/*
+ * frame_free(void* addr, uint32_t count)
+ * Decsription: Gives frames from frame_alloc back to the allocator
+ * Inputs: addr - physical address of the first frame, count - number of frames
+ * Outputs: none
+ */
+void frame_free(void* addr, uint32_t count) {
+    uint32_t first = ((uint32_t) addr) / FRAME_SIZE;
+    if(((uint32_t) addr) % FRAME_SIZE != 0 || ((uint32_t) addr) < FRAMES_START ||
+            first + count > NUM_FRAMES) {
+        log(ERROR, "Freeing frames the allocator doesn't own", "frame_free");
+        return;
+    }
+
+    mark_frames(first, count, 0);
+}
+
+/*
+ * frames_free()
+ * Decsription: Gets how much physical memory is left
+ * Inputs: none
+ * Outputs: number of free frames
+ */
+uint32_t frames_free() {
+    return num_free_frames;
+}
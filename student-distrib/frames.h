@@ -0,0 +1,39 @@
+/**
+ * frames.h
+ *
+ * vim:ts=4 expandtab
+ */
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include "types.h"
+#include "multiboot.h"
+
+#define FRAME_SIZE FOUR_KB
+
+/*
+ * Physical memory handed out by the frame allocator. Everything below 8MB
+ * belongs to the kernel image, its boot stack and video memory. Memory up to
+ * 128MB is identity mapped for the kernel in every page directory, so frames
+ * can be used right away without mapping them first. 128MB is also where the
+ * user program window starts
+ */
+#define FRAMES_START EIGHT_MB
+#define FRAMES_END   (128 * MB)
+
+// Frames tracked by the bitmap, starting from physical address 0
+#define NUM_FRAMES (FRAMES_END / FRAME_SIZE)
+
+// set up the free frame bitmap from the multiboot memory map
+void init_frames(multiboot_info_t* mbi);
+
+// allocate count contiguous frames, aligned to align frames
+void* frame_alloc(uint32_t count, uint32_t align);
+
+// give count contiguous frames back to the allocator
+void frame_free(void* addr, uint32_t count);
+
+// get the number of free frames
+uint32_t frames_free();
+
+#endif /* FRAMES_H */
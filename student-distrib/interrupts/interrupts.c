@@ -127,6 +127,15 @@ void set_idt_entry(uint8_t idx, uint32_t handler, uint8_t type, uint8_t dpl) {
 extern void isr_handler(uint32_t isr_index, uint32_t error_code) {
     // Handle exceptions differently
     if(isr_index <= MAX_EXCEPTION_ISR) {
+        // Pages of the program window are mapped the first time they are touched
+        if(isr_index == PAGEFAULT_IDT) {
+            uint32_t fault_addr;
+            asm volatile("movl %%cr2, %0" : "=r"(fault_addr));
+            if(user_page_fault(fault_addr, error_code) == 0) {
+                return;
+            }
+        }
+
         printf("\nAn exception has occurred. You're Fired!\n");
         printf("ISR: %d\n", isr_index);
         if(error_code != 0xDEADBEEF) {
@@ -233,12 +242,11 @@ void keyboard_isr() {
         return;
     }
 
-    // On CTRL-c, halt the current task
+    // On CTRL-c, halt the foreground task of the terminal on screen
     //TODO: CTRL-c for programs, CTRL-d for shells
-    //TODO: Actually use signals lol jk
     if(ctrl_pressed == 1 && key == 'c') {
         send_eoi(KEYBOARD_IRQ);
-        do_syscall(SYSCALL_HALT_NUM, 0, 0, 0);
+        task_kill(active_pids[current_terminal]);
         return;
     }
 
@@ -252,57 +260,18 @@ void keyboard_isr() {
         return;
     }
 
-    // Support switching between terminals with ALT-F{1,2,3}
-    if(alt_pressed == 1 && scan_code == F1) {
-        log(DEBUG, "Switch to first terminal!", "isr");
-        current_terminal = 0;
+    // Support switching between terminals with ALT-F{1,2,3}. Only the
+    // screen changes hands; every terminal's tasks keep being scheduled.
+    if(alt_pressed == 1 && scan_code >= F1 && scan_code <= F3) {
         send_eoi(KEYBOARD_IRQ);
-
-        if(shell_pids[0] > 0) {
-            // A shell has already been started for this terminal
-            log(DEBUG, "Shell already exists for terminal 0!", "isr");
-
-            // Switch to base shell of terminal 0
-            task_switch(active_pids[0], SWITCH_SCREEN);
-        } else {
-            // Need to start a new shell for this terminal
-            do_execute((uint8_t *)"shell");
-        }
-
+        terminal_switch(scan_code - F1);
         return;
-    } else if(alt_pressed == 1 && scan_code == F2) {
-        log(DEBUG, "Switch to second terminal!", "isr");
-        current_terminal = 1;
-        send_eoi(KEYBOARD_IRQ);
-
-        if(shell_pids[1] > 0) {
-            // A shell has already been started for this terminal
-            log(DEBUG, "Shell already exists for terminal 1!", "isr");
-
-            // Switch to base shell of terminal 1
-            task_switch(active_pids[1], SWITCH_SCREEN);
-        } else {
-            // Need to start a new shell for this terminal
-            do_execute((uint8_t *)"shell");
-        }
+    }
 
-        return;
-    } else if(alt_pressed == 1 && scan_code == F3) {
-        log(DEBUG, "Switch to third terminal!", "isr");
-        current_terminal = 2;
+    // Shift-PgUp/PgDn scroll the terminal on screen through its history
+    if(shift_bitmask && (scan_code == PAGE_UP_PRESS || scan_code == PAGE_DOWN_PRESS)) {
+        scroll_view(current_terminal, (scan_code == PAGE_UP_PRESS) ? SCROLLBACK_PAGE : -SCROLLBACK_PAGE);
         send_eoi(KEYBOARD_IRQ);
-
-        if(shell_pids[2] > 0) {
-            // A shell has already been started for this terminal
-            log(DEBUG, "Shell already exists for terminal 2!", "isr");
-
-            // Switch to base shell of terminal 2
-            task_switch(active_pids[2], SWITCH_SCREEN);
-        } else {
-            // Need to start a new shell for this terminal
-            do_execute((uint8_t *)"shell");
-        }
-
         return;
     }
 
@@ -333,8 +302,12 @@ void rtc_isr() {
     outb(0x0C, RTC_INDEX_PORT);
     inb(RTC_DATA_PORT);
 
-    // increment tick counter
+    // increment tick counter, and wake the readers once the earliest is due.
+    // Any not due yet go back to sleep and set the next wakeup again
     tick_counter++;
+    if(rtc_wait_queue.head != NULL && (int32_t) (tick_counter - rtc_next_wakeup) >= 0) {
+        wait_queue_wake_all(&rtc_wait_queue);
+    }
 
     send_eoi(RTC_IRQ);
 }
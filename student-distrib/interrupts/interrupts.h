@@ -56,6 +56,8 @@
 #define ALT_PRESS               0x38
 #define ALT_RELEASE             0xB8
 #define CAPS_LOCK_PRESS         0x3A
+#define PAGE_UP_PRESS           0x49
+#define PAGE_DOWN_PRESS         0x51
 #define F1                      0x3B
 #define F2                      0x3C
 #define F3                      0x3D
@@ -4,16 +4,10 @@
  * vim:ts=4 expandtab
  */
 #include "syscalls.h"
-
-/*
- * This label needs to be global so that we can jump to it from other files,
- * namely from task_switch in tasks.c
- */
-asm(".globl halt_ret_lbl");
+#include "../exe_cache.h"
 
 // Declared in tasks.c
 extern file_desc_t kernel_file_array[FILE_ARRAY_SIZE];
-extern uint32_t pid_use_array[MAX_TASKS + 1];
 
 // Declared in terminal.c
 extern volatile uint32_t shell_pids[NUM_TERMINALS];
@@ -22,238 +16,360 @@ extern volatile uint32_t current_terminal;
 
 /*
  * sys_halt(uint8_t status)
- * Decsription: Halt the system shells
- * Inputs: status - ignored
- * Outputs: -1 on failure, DEADBEEF on success
+ * Decsription: Halt the current task and hand its status to the parent
+ * Inputs: status - returned by the parent's execute call
+ * Outputs: -1 on failure, never returns on success
  */
 int32_t sys_halt(uint8_t status) {
-    pcb_t* pcb_ptr = get_pcb_ptr();
-    if(pcb_ptr == NULL) {
+    pcb_t* pcb = get_pcb_ptr();
+    if(pcb == NULL) {
         log(WARN, "Can't halt the kernel!", "halt");
         return -1;
     }
-    pcb_t pcb = *pcb_ptr;
 
-    // close() all opened files
+    // close() all opened files, then free the table if it grew
     int i;
-    for(i = 0; i < FILE_ARRAY_SIZE; i++) {
-        sys_close(i);
+    for(i = STDOUT_FD + 1; i < pcb->fds.size; i++) {
+        if(get_file_desc(i) != NULL) {
+            sys_close(i);
+        }
     }
+    fd_table_free(&(pcb->fds));
 
-    // Clear pcb structure
-    memset(get_pcb_ptr(), 0x00, sizeof(pcb_t));
+    uint32_t t_idx = pcb->terminal_index;
+    pcb_t* next;
+
+    // Check to see if we are halting the base shell for a terminal. If so, execute another
+    if(shell_pids[t_idx] == pcb->pid) {
+        log(DEBUG, "Exiting base terminal. Executing another", "halt");
+        shell_pids[t_idx] = 0;
+        active_pids[t_idx] = 0;
+        next = spawn_task((uint8_t*) "shell", t_idx, KERNEL_PID);
+    } else {
+        // Wake the parent up inside its execute call
+        next = get_pcb_ptr_pid(pcb->parent_pid);
+        next->child_status = status;
+        next->state = TASK_RUNNABLE;
+        active_pids[t_idx] = pcb->parent_pid;
+    }
+
+    /*
+     * The PCB, kernel stack and paging structures are still in use until we
+     * switch away, so whichever task runs next frees them
+     */
+    task_exit();
+
+    if(next == NULL) {
+        task_schedule();
+    } else {
+        task_switch(next);
+    }
 
-    // Free up PID for future use
-    pid_use_array[pcb.pid] = 0;
+    // This function should never return to the caller
+    return 0xDEADBEEF;
+}
 
-    for(i = 0; i < NUM_TERMINALS; i++) {
-        if(active_pids[i] == pcb.pid) {
-            active_pids[i] = pcb.parent_pid;
+/*
+ * exe_page_writable(elf_phdr_t* phdrs, uint32_t num_phdrs, uint32_t page)
+ * Decsription: Checks whether any writable loadable segment overlaps a page
+ * Inputs: phdrs - program headers, num_phdrs - number of headers, page - virtual page address
+ * Outputs: 1 if the page may be written by the program, 0 otherwise
+ */
+static int32_t exe_page_writable(elf_phdr_t* phdrs, uint32_t num_phdrs, uint32_t page) {
+    uint32_t i;
+    for(i = 0; i < num_phdrs; i++) {
+        if(phdrs[i].type != ELF_PT_LOAD || !(phdrs[i].flags & ELF_PF_W)) {
+            continue;
         }
 
-        // Check to see if we are halting the base shell for a terminal. If so, execute another
-        if(shell_pids[i] == pcb.pid) {
-            log(DEBUG, "Exiting base terminal. Executing another", "halt");
-            shell_pids[i] = 0;
-            do_execute((uint8_t*) "shell");
+        if(phdrs[i].vaddr < page + FOUR_KB && phdrs[i].vaddr + phdrs[i].memsz > page) {
+            return 1;
         }
     }
+    return 0;
+}
 
-    // Write TSS with parent process's kernel stack
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = ((8 * MB) - ((pcb.parent_pid) * (8 * KB)) - 4);
+/*
+ * exe_set_layout(pcb_t* pcb, exe_cache_entry_t* exe)
+ * Decsription: Records where each loadable segment of the program is filled
+ *              in from: its program header's file offset, or where it lies
+ *              in memory for a flat image. Also marks which pages of the
+ *              program window can be mapped read-only straight from the
+ *              filesystem image: those of a segment that no writable segment
+ *              touches and whose file contents start on a block, if the image
+ *              can be mapped at all
+ * Inputs: pcb - task being loaded, exe - cache entry of its executable
+ * Outputs: none
+ */
+static void exe_set_layout(pcb_t* pcb, exe_cache_entry_t* exe) {
+    uint32_t i;
+    for(i = 0; i < exe->num_phdrs && pcb->num_segments < TASK_MAX_SEGMENTS; i++) {
+        elf_phdr_t* phdr = &(exe->phdrs[i]);
+        if(phdr->type != ELF_PT_LOAD || phdr->filesz == 0) {
+            continue;
+        }
 
-    // Save old ESP and EBP in registers
-    register uint32_t parent_esp = pcb.parent_esp;
-    register uint32_t parent_ebp = pcb.parent_ebp;
+        // A flat image holds the whole segment, bss included, where it is in memory
+        task_segment_t* segment = &(pcb->segments[pcb->num_segments++]);
+        segment->vaddr = phdr->vaddr;
+        segment->offset = exe->flat ? phdr->vaddr - EXE_LOAD_ADDR : phdr->offset;
+        segment->filesz = exe->flat ? phdr->memsz : phdr->filesz;
 
-    // Restore parent's paging
-    restore_parent_paging(pcb.pid, pcb.parent_pid);
+        // Pages only line up with blocks if the segment is offset the same in the file
+        if(!exe->mappable || (segment->vaddr - segment->offset) % FS_BLOCK_SIZE != 0) {
+            continue;
+        }
 
-    // Restore parent's ESP/EBP
-    asm volatile ("movl %0, %%esp;"::"r"(parent_esp));
-    asm volatile ("movl %0, %%ebp;"::"r"(parent_ebp));
-    asm volatile ("jmp halt_ret_lbl;");
+        uint32_t page;
+        for(page = segment->vaddr & ~(FOUR_KB - 1); page < segment->vaddr + segment->filesz; page += FOUR_KB) {
+            uint32_t offset = segment->offset + (page - segment->vaddr);
 
-    // This function should never return to the caller
-    return 0xDEADBEEF;
+            // Pages where the segment's zero-filled part starts need a frame of their own
+            if(page < EXE_LOAD_ADDR || page >= USER_PAGE_VIRT + FOUR_MB || offset >= exe->length ||
+                    (phdr->memsz > segment->filesz && page + FOUR_KB > segment->vaddr + segment->filesz) ||
+                    exe_page_writable(exe->phdrs, exe->num_phdrs, page)) {
+                continue;
+            }
+
+            uint32_t index = (page - USER_PAGE_VIRT) / FOUR_KB;
+            pcb->exe_shared[index / 32] |= (1 << (index % 32));
+        }
+    }
 }
 
 /*
- * sys_execute(const uint8_t* command)
- * Decsription: execute commands
- * Inputs: command - the command to execute
- * Outputs: -1 on failure, 0 on success
+ * exe_page_offset(pcb_t* pcb, uint32_t page)
+ * Decsription: Finds where in the executable a page of a segment starts
+ * Inputs: pcb - task, page - page of the program window inside a segment
+ * Outputs: offset into the executable file
  */
-int32_t sys_execute(const uint8_t* command) {
-    // Copy command until first space as executable
-    uint8_t executable_fname[FS_FNAME_LEN];
-    memset(executable_fname, 0x00, FS_FNAME_LEN);
-
-    int i = 0;
-    while(1) {
-        if(command[i] == 0x00 || command[i] == ' ') {
-            break;
+static uint32_t exe_page_offset(pcb_t* pcb, uint32_t page) {
+    uint32_t i;
+    for(i = 0; i < pcb->num_segments; i++) {
+        task_segment_t* segment = &(pcb->segments[i]);
+        if(page >= (segment->vaddr & ~(FOUR_KB - 1)) && page < segment->vaddr + segment->filesz) {
+            return segment->offset + (page - segment->vaddr);
         }
-        executable_fname[i] = command[i];
-        i++;
     }
+    return page - EXE_LOAD_ADDR;
+}
 
-    uint8_t task_args[MAX_ARGS_LENGTH];
-    memset(task_args, 0x00, MAX_ARGS_LENGTH);
-    // Copy args into task_args
-    int ia = i;
-    if (command[ia] == ' ') {
-      ia++;
-      while (ia < MAX_ARGS_LENGTH && ia < strlen((int8_t*)command) && command[ia] != 0x00) {
-        task_args[ia - i - 1] = command[ia];
-        ia++;
-      }
+/*
+ * exe_read(pcb_t* pcb, uint32_t offset, uint8_t* buf, uint32_t length)
+ * Decsription: Reads part of a task's executable, from the cached image if
+ *              it is still around. Nothing is read past the end of the file
+ * Inputs: pcb - task, offset - offset into the file, buf - where to read to,
+ *         length - bytes to read
+ * Outputs: none
+ */
+static void exe_read(pcb_t* pcb, uint32_t offset, uint8_t* buf, uint32_t length) {
+    if(offset >= pcb->exe_length) {
+        return;
+    }
+    if(length > pcb->exe_length - offset) {
+        length = pcb->exe_length - offset;
     }
 
-    // Open the executable file
-    int fd = sys_open(executable_fname);
-    if(fd == -1) {
-        log(WARN, "Filename invalid", "execute");
-        return -1;
+    exe_cache_entry_t* exe = exe_cache_find(pcb->exe_inode);
+    if(exe != NULL && exe->image != NULL) {
+        memcpy(buf, exe->image + offset, length);
+    } else {
+        read_data(pcb->exe_inode, offset, buf, length);
     }
+}
 
-    // Read the executable file header
-    uint8_t header[EXE_HEADER_LEN];
-    memset(header, 0x00, EXE_HEADER_LEN);
-    if(sys_read(fd, header, EXE_HEADER_LEN) == -1) {
-        log(WARN, "Can't read executable header", "execute");
-        sys_close(fd);
+/*
+ * user_page_fault(uint32_t addr, uint32_t error_code)
+ * Decsription: Maps in the page of the program window a task just touched
+ *              for the first time. Pages of the executable are mapped from
+ *              the filesystem image or filled in from the segments covering
+ *              them, and heap pages below the break and stack pages get a
+ *              zero-filled frame. Faults on pages that are present, outside
+ *              the window, below the program or between the break and the
+ *              stack reserve can't be fixed
+ * Inputs: addr - faulting address (CR2), error_code - page fault error code
+ * Outputs: -1 if the fault can't be resolved, 0 if the access can be retried
+ */
+int32_t user_page_fault(uint32_t addr, uint32_t error_code) {
+    pcb_t* pcb = get_pcb_ptr();
+    if(pcb == NULL || (error_code & PF_PROTECTION) ||
+            addr < USER_PAGE_VIRT || addr >= USER_PAGE_VIRT + FOUR_MB) {
         return -1;
     }
 
-    // Seek to beginning of executable for program loader
-    if(fs_seek(fd, 0) == -1) {
-        log(WARN, "Couldn't seek to beginning of executable", "execute");
-        sys_close(fd);
+    uint32_t page = addr & ~(FOUR_KB - 1);
+
+    // Only the program, the heap up to the break and the stack reserve can be touched
+    uint32_t heap_top = (pcb->brk + FOUR_KB - 1) & ~(FOUR_KB - 1);
+    if(page < EXE_LOAD_ADDR || (page >= heap_top && page < USER_HEAP_END)) {
         return -1;
     }
 
-    // Check for presence of magic number in header
-    if(((uint32_t*) header)[EXE_HEADER_MAGICNUM_IDX] != EXE_HEADER_MAGIC) {
-        log(WARN, "Magic number not present", "execute");
-        sys_close(fd);
+    uint32_t index = (page - USER_PAGE_VIRT) / FOUR_KB;
+    if(pcb->exe_shared[index / 32] & (1 << (index % 32))) {
+        // Blocks are identity mapped, so their address is also the physical one
+        uint32_t offset = exe_page_offset(pcb, page);
+        map_task_image_page(pcb->pid, fs_get_data_block(pcb->exe_inode, offset / FS_BLOCK_SIZE),
+                (void*) page);
+        return 0;
+    }
+
+    uint8_t* frame = map_task_frame(pcb->pid, (void*) page);
+    if(frame == NULL) {
         return -1;
     }
+    memset(frame, 0x00, FOUR_KB);
 
-    // Get code entry point from header
-    uint32_t entry_point = ((uint32_t*) header)[EXE_HEADER_ENTRY_IDX];
+    if(pcb->num_segments == 0) {
+        // Without program headers, the file is loaded as is
+        exe_read(pcb, page - EXE_LOAD_ADDR, frame, FOUR_KB);
+        return 0;
+    }
 
-    cli(); // Begin critical section
+    // Copy in the file contents of every segment reaching into the page
+    uint32_t i;
+    for(i = 0; i < pcb->num_segments; i++) {
+        task_segment_t* segment = &(pcb->segments[i]);
+        uint32_t start = (segment->vaddr > page) ? segment->vaddr : page;
+        uint32_t end = segment->vaddr + segment->filesz;
+        if(end > page + FOUR_KB) {
+            end = page + FOUR_KB;
+        }
+        if(start < end) {
+            exe_read(pcb, segment->offset + (start - segment->vaddr), frame + (start - page), end - start);
+        }
+    }
+
+    return 0;
+}
 
-    // Search for available PID
-    int new_pid;
-    for(new_pid = 1; new_pid <= MAX_TASKS; new_pid++) {
-        if(pid_use_array[new_pid] == 0) {
+/*
+ * spawn_task(const uint8_t* command, uint32_t terminal, uint32_t parent_pid)
+ * Decsription: Loads the program named by command into a new task on
+ *              terminal. The task enters the program the first time it is
+ *              switched to, but is not put on the run queue. A parent_pid of
+ *              KERNEL_PID makes it the base shell of the terminal. Interrupts
+ *              must be disabled
+ * Inputs: command - program name and arguments, terminal - terminal to run on,
+ *         parent_pid - task to wake when it halts
+ * Outputs: NULL on failure, the new task's PCB on success
+ */
+pcb_t* spawn_task(const uint8_t* command, uint32_t terminal, uint32_t parent_pid) {
+    // Copy command until first space as executable
+    uint8_t executable_fname[FS_FNAME_LEN + 1];
+    memset(executable_fname, 0x00, FS_FNAME_LEN + 1);
+
+    int i = 0;
+    while(i < FS_FNAME_LEN) {
+        if(command[i] == 0x00 || command[i] == ' ') {
             break;
         }
+        executable_fname[i] = command[i];
+        i++;
     }
-    if(new_pid == MAX_TASKS + 1) {
-        log(ERROR, "Reached maximum number of tasks", "execute");
-        sys_close(fd);
-        return -1;
-    }
-
-    // Mark the task we are executing as the active task of the current terminal
-    active_pids[current_terminal] = new_pid;
 
-    // Fetch old PCB structure (or NULL if we're running pre-task kernel)
-    pcb_t* old_pcb = get_pcb_ptr();
+    // Args follow the first space, and are copied straight into the PCB below
+    const uint8_t* task_args = &command[i + 1];
+    uint32_t args_length = (command[i] == ' ') ? strlen((int8_t*) task_args) : 0;
+    if(args_length > MAX_ARGS_LENGTH - i - 1) {
+        args_length = MAX_ARGS_LENGTH - i - 1;
+    }
 
-    // Set up paging structures for new process
-    init_task_paging(new_pid);
+    // Find the executable file
+    dentry_t dentry;
+    if(read_dentry_by_name(executable_fname, &dentry) == -1 || dentry.type != FS_TYPE_FILE) {
+        log(WARN, "Filename invalid", "execute");
+        return NULL;
+    }
 
-    // Check if we are executing a new base shell for a terminal
-    if(strncmp(((int8_t*) executable_fname), "shell", 5) == 0) {
-        if(shell_pids[current_terminal] == 0) {
-            shell_pids[current_terminal] = new_pid;
-        }
+    // Checked once per executable, then remembered
+    exe_cache_entry_t* exe = exe_cache_lookup(dentry.inode_num);
+    if(!exe->executable) {
+        log(WARN, "Not an executable", "execute");
+        return NULL;
     }
 
-    // Load program image into memory from the file system
-    void* program_image_mem = (void*) 0x08048000;
-    if(sys_read(fd, program_image_mem, fs_len(fd)) == -1) {
-        log(WARN, "Program loader read failed", "execute");
-        sys_close(fd);
-        restore_parent_paging(new_pid, (old_pcb == NULL) ? KERNEL_PID : old_pcb->pid);
-        return -1;
+    // Reserve a PID along with its kernel stack
+    int32_t new_pid = task_alloc_pid();
+    if(new_pid == -1) {
+        log(ERROR, "Can't create another task", "execute");
+        return NULL;
     }
 
-    // Close executable file, as it is now in memory
-    if(sys_close(fd) == -1) {
-        log(WARN, "Couldn't close executable file", "execute");
-        restore_parent_paging(new_pid, (old_pcb == NULL) ? KERNEL_PID : old_pcb->pid);
-        return -1;
+    // Set up paging structures for new process
+    if(init_task_paging(new_pid) == -1) {
+        log(ERROR, "Can't allocate memory for the program", "execute");
+        task_free_pid(new_pid);
+        return NULL;
     }
 
     // Set up process control block
     pcb_t* new_pcb = init_pcb(new_pid);
-    new_pcb->terminal_index = current_terminal;
+    new_pcb->terminal_index = terminal;
+    new_pcb->parent_pid = parent_pid;
 
-    // Mark PID as used
-    pid_use_array[new_pid] = 1;
+    // The program is paged in as it runs, from the segments of the executable
+    new_pcb->exe_inode = exe->inode;
+    new_pcb->exe_length = exe->length;
+    exe_set_layout(new_pcb, exe);
 
-    // Put arguments in task's PCB
-    memcpy(new_pcb->args, task_args, MAX_ARGS_LENGTH);
+    // The heap starts out empty, right after the program
+    new_pcb->heap_start = exe->image_end;
+    new_pcb->brk = exe->image_end;
 
+    // Put arguments in task's PCB (the template left the rest zeroed)
+    memcpy(new_pcb->args, task_args, args_length);
 
-    /*
-     * First, save the video memory from the current terminal to the backing
-     * store, as well as the cursor position. Then, remap the old tasks's
-     * VIDEO memory to the backing store and map new tasks's video memory to
-     * physical VIDEO addr
-     */
-    switch_active_terminal_screen((old_pcb == NULL) ? KERNEL_PID : old_pcb->pid, new_pid);
-    remap_video_memory((old_pcb == NULL) ? KERNEL_PID : old_pcb->pid, new_pid);
+    // Start the task off at the program's entry point in user mode
+    task_init_context(new_pcb, exe->entry_point);
+
+    // The new task is now the one in the foreground of its terminal
+    active_pids[terminal] = new_pid;
+    if(parent_pid == KERNEL_PID) {
+        shell_pids[terminal] = new_pid;
+    }
 
-    // Initiate Context Switch
+    return new_pcb;
+}
 
-    // Write TSS with new process's kernel stack
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = ((8 * MB) - ((new_pid) * (8 * KB)) - 4);
+/*
+ * sys_execute(const uint8_t* command)
+ * Decsription: execute commands
+ * Inputs: command - the command to execute
+ * Outputs: -1 on failure, status passed to halt by the program on success
+ */
+int32_t sys_execute(const uint8_t* command) {
+    if(command == NULL) {
+        log(WARN, "NULL command", "execute");
+        return -1;
+    }
 
-    // Save parent PID in the PCB. Should be KERNEL_PID for new base shells
-    if(shell_pids[current_terminal] == new_pid) {
-        new_pcb->parent_pid = KERNEL_PID;
-    } else {
-        new_pcb->parent_pid = (old_pcb == NULL) ? KERNEL_PID : old_pcb->pid;
-    }
-
-    // Save esp/ebp in the PCB
-    register uint32_t esp asm ("esp");
-    new_pcb->parent_esp = esp;
-    register uint32_t ebp asm ("ebp");
-    new_pcb->parent_ebp = ebp;
-
-    // Load USER_DS into stack segment selectors
-    asm volatile ("movw %w0, %%ax;"::"r"(USER_DS));
-    asm volatile ("movw %%ax, %%ds;\
-                   movw %%ax, %%es;\
-                   movw %%ax, %%fs;\
-                   movw %%ax, %%gs;":);
-
-    // Push artificial IRET context on stack
-    asm volatile ("pushl %0;"::"r"(USER_DS)); // Stack segment selector
-    asm volatile ("pushl %0;"::"r"((132 * MB) - 4)); // Stack pointer
-    asm volatile ("pushfl;\
-                   popl %%ecx;\
-                   orl  $0x200, %%ecx;\
-                   pushl %%ecx;":); // EFLAGS (with IF set)
-    asm volatile ("pushl %0;"::"r"(USER_CS)); // Code segment selector
-    asm volatile ("pushl %0;"::"r"(entry_point)); // EIP
-
-    // IRET - Going to user mode!
-    asm volatile("iret;");
+    cli(); // Begin critical section
+
+    // Fetch old PCB structure (or NULL if we're running pre-task kernel)
+    pcb_t* old_pcb = get_pcb_ptr();
+
+    if(old_pcb == NULL) {
+        // Started by the kernel: a base shell for the current terminal, run once scheduled
+        pcb_t* new_pcb = spawn_task(command, current_terminal, KERNEL_PID);
+        if(new_pcb == NULL) {
+            return -1;
+        }
+        task_enqueue(new_pcb);
+        return 0;
+    }
+
+    pcb_t* new_pcb = spawn_task(command, old_pcb->terminal_index, old_pcb->pid);
+    if(new_pcb == NULL) {
+        return -1;
+    }
+
+    // Sleep until the child halts, handing the CPU straight to it
+    old_pcb->state = TASK_WAITING;
+    task_switch(new_pcb);
 
     // Back from halt()!
-    asm volatile("halt_ret_lbl:");
-    sti();
-    return 0; //TODO: status
+    return old_pcb->child_status;
 }
 
 /*
@@ -263,19 +379,14 @@ int32_t sys_execute(const uint8_t* command) {
  * Outputs: -1 on failure, number of read bytes on success
  */
 int32_t sys_read(int32_t fd, void* buf, int32_t nbytes) {
-    if(fd < 0 || fd >= FILE_ARRAY_SIZE) {
-        log(WARN, "fd out of range", "read");
-        return -1;
-    }
-
-    file_desc_t file = get_file_array()[fd];
-    if(!(file.flags & 0x1)) {
+    file_desc_t* file = get_file_desc(fd);
+    if(file == NULL) {
         log(WARN, "Invalid file descriptor", "read");
         return -1;
     }
 
     sti(); // Enable further interrupts
-    return file.read(fd, buf, nbytes);
+    return file->ops->read(fd, buf, nbytes);
 }
 
 /*
@@ -285,18 +396,13 @@ int32_t sys_read(int32_t fd, void* buf, int32_t nbytes) {
  * Outputs: -1 on failure, written file
  */
 int32_t sys_write(int32_t fd, const void* buf, int32_t nbytes) {
-    if(fd < 0 || fd >= FILE_ARRAY_SIZE) {
-        log(WARN, "fd out of range", "write");
-        return -1;
-    }
-
-    file_desc_t file = get_file_array()[fd];
-    if(!(file.flags & 0x1)) {
+    file_desc_t* file = get_file_desc(fd);
+    if(file == NULL) {
         log(WARN, "Invalid file descriptor", "write");
         return -1;
     }
 
-    return file.write(fd, buf, nbytes);
+    return file->ops->write(fd, buf, nbytes);
 }
 
 /*
@@ -317,57 +423,38 @@ int32_t sys_open(const uint8_t* filename) {
         return -1;
     }
 
-    file_desc_t* file_array = get_file_array();
-
-    int i;
-    for(i = 2; i < FILE_ARRAY_SIZE; i++) {
-        file_desc_t file = file_array[i];
-
-        // Check if file descriptor is unused
-        if((file.flags & 0x1) == 0) {
-
-            file.flags |= 0x1; // Mark as in-use
-            file.inode_num = dentry.inode_num;
-
-            if(dentry.type == FS_TYPE_RTC) {
-                file.read = rtc_read;
-                file.write = rtc_write;
-                file.open = rtc_open;
-                file.close = rtc_close;
-            } else if(dentry.type == FS_TYPE_DIR) {
-                file.file_pos = 0;
-                file.read = fs_dir_read;
-                file.write = fs_write;
-                file.open = fs_open;
-                file.close = fs_close;
-            } else if(dentry.type == FS_TYPE_FILE) {
-                file.file_pos = 0;
-                file.read = fs_read;
-                file.write = fs_write;
-                file.open = fs_open;
-                file.close = fs_close;
-            } else {
-                memset(&file, 0x00, sizeof(file_desc_t));
-                file_array[i] = file;
-                log(ERROR, "Invalid dentry type", "open");
-                return -1;
-            }
+    fd_table_t* table = get_fd_table();
+    int32_t fd = fd_alloc(table);
+    if(fd == -1) {
+        log(WARN, "No remaining file descriptors", "open");
+        return -1;
+    }
 
-            file_array[i] = file;
+    file_desc_t* file = &(table->files[fd]);
+    file->inode_num = dentry.inode_num;
 
-            // Pass-through to specific open() function
-            if(file.open(filename) == -1) {
-                log(WARN, "specific open() function failed", "open");
-                return -1;
-            }
+    if(dentry.type == FS_TYPE_RTC) {
+        file->rtc_interval = RTC_INTERVAL(RTC_DEFAULT_FREQ);
+        file->ops = &rtc_ops;
+    } else if(dentry.type == FS_TYPE_DIR) {
+        file->ops = &fs_dir_ops;
+    } else if(dentry.type == FS_TYPE_FILE) {
+        file->ops = &fs_file_ops;
+    } else {
+        fd_free(table, fd);
+        log(ERROR, "Invalid dentry type", "open");
+        return -1;
+    }
 
-            // Return newly allocated file descriptor
-            return i;
-        }
+    // Pass-through to specific open() function
+    if(file->ops->open(filename) == -1) {
+        fd_free(table, fd);
+        log(WARN, "specific open() function failed", "open");
+        return -1;
     }
 
-    log(WARN, "No remaining file descriptors", "open");
-    return -1;
+    // Return newly allocated file descriptor
+    return fd;
 }
 
 /*
@@ -377,31 +464,23 @@ int32_t sys_open(const uint8_t* filename) {
  * Outputs: -1 on failure, file close
  */
 int32_t sys_close(int32_t fd) {
-    if(fd < 0 || fd >= FILE_ARRAY_SIZE) {
-        log(WARN, "fd out of range", "close");
-        return -1;
-    }
-
     if(fd == STDIN_FD || fd == STDOUT_FD) {
         log(WARN, "Can't close stdin/stdout", "close");
         return -1;
     }
 
-    file_desc_t* file_array = get_file_array();
-
-    file_desc_t file = file_array[fd];
-    if(file.flags & 0x1) {
-        // Remove the file descriptor from the file array
-        file_desc_t empty;
-        memset(&empty, 0x00, sizeof(file_desc_t));
-        file_array[fd] = empty;
-
-        // Pass-through to specific close() function
-        return file.close(fd);
-    } else {
+    file_desc_t* file = get_file_desc(fd);
+    if(file == NULL) {
         log(WARN, "Invalid file descriptor", "close");
         return -1;
     }
+
+    // Remove the file descriptor from the file array
+    const file_ops_t* ops = file->ops;
+    fd_free(get_fd_table(), fd);
+
+    // Pass-through to specific close() function
+    return ops->close(fd);
 }
 
 /*
@@ -454,8 +533,10 @@ int32_t sys_vidmap(uint8_t** screen_start) {
         return 0;
     }
 
-    // Map phys addr VIDEO to virt addr 1GB
-    mmap(((void*) VIDEO), ((void*) GB), ACCESS_ALL);
+    // Map the task's terminal screen to virt addr 1GB. It never moves, so it doesn't need remapping later
+    if(mmap(get_terminal_video_mem(get_pcb_ptr()->terminal_index), ((void*) GB), ACCESS_ALL) == -1) {
+        return -1;
+    }
     *screen_start = (void*) GB;
     return 0;
 }
@@ -481,6 +562,117 @@ int32_t sys_sigreturn(void) {
   return -1;
 }
 
+/*
+ * sys_readv(int32_t fd, const iovec_t* iov, int32_t iovcnt)
+ * Decsription: Reads into several buffers in turn with one system call.
+ *              Stops early once a read comes up short, like at end of file
+ * Inputs: fd - file descriptor, iov - buffers to fill, iovcnt - number of buffers
+ * Outputs: -1 on failure, total number of bytes read otherwise
+ */
+int32_t sys_readv(int32_t fd, const iovec_t* iov, int32_t iovcnt) {
+    if(iov == NULL || iovcnt <= 0 || iovcnt > IOV_MAX) {
+        log(WARN, "Invalid buffer list", "readv");
+        return -1;
+    }
+
+    file_desc_t* file = get_file_desc(fd);
+    if(file == NULL) {
+        log(WARN, "Invalid file descriptor", "readv");
+        return -1;
+    }
+
+    sti(); // Enable further interrupts
+
+    int32_t total = 0;
+    int32_t i;
+    for(i = 0; i < iovcnt; i++) {
+        int32_t count = file->ops->read(fd, iov[i].base, iov[i].len);
+        if(count == -1) {
+            return (total == 0) ? -1 : total;
+        }
+
+        total += count;
+        if(count < iov[i].len) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*
+ * sys_writev(int32_t fd, const iovec_t* iov, int32_t iovcnt)
+ * Decsription: Writes several buffers in turn with one system call
+ * Inputs: fd - file descriptor, iov - buffers to write, iovcnt - number of buffers
+ * Outputs: -1 on failure, total number of bytes written otherwise
+ */
+int32_t sys_writev(int32_t fd, const iovec_t* iov, int32_t iovcnt) {
+    if(iov == NULL || iovcnt <= 0 || iovcnt > IOV_MAX) {
+        log(WARN, "Invalid buffer list", "writev");
+        return -1;
+    }
+
+    file_desc_t* file = get_file_desc(fd);
+    if(file == NULL) {
+        log(WARN, "Invalid file descriptor", "writev");
+        return -1;
+    }
+
+    int32_t total = 0;
+    int32_t i;
+    for(i = 0; i < iovcnt; i++) {
+        int32_t count = file->ops->write(fd, iov[i].base, iov[i].len);
+        if(count == -1) {
+            return (total == 0) ? -1 : total;
+        }
+
+        total += count;
+        if(count < iov[i].len) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*
+ * sys_sbrk(int32_t increment)
+ * Decsription: Grows or shrinks the task's heap, which lies between the end
+ *              of the program and the stack. New heap pages are zero-filled
+ *              frames mapped the first time they are touched, and pages the
+ *              heap shrinks off of are freed right away and fault if touched
+ *              again
+ * Inputs: increment - bytes to add to the heap, negative to give them back
+ * Outputs: -1 on failure, the old end of the heap (the start of new memory) on success
+ */
+int32_t sys_sbrk(int32_t increment) {
+    pcb_t* pcb = get_pcb_ptr();
+    if(pcb == NULL) {
+        log(WARN, "The kernel has no heap", "sbrk");
+        return -1;
+    }
+
+    uint32_t old_brk = pcb->brk;
+    if((increment > 0 && (old_brk >= USER_HEAP_END || (uint32_t) increment > USER_HEAP_END - old_brk)) ||
+            (increment < 0 && 0 - (uint32_t) increment > old_brk - pcb->heap_start)) {
+        log(WARN, "Heap can't grow or shrink that far", "sbrk");
+        return -1;
+    }
+
+    uint32_t new_brk = old_brk + increment;
+
+    // Free the pages the heap no longer reaches into, flushing the TLB once for all of them
+    uint32_t page;
+    paging_batch_begin();
+    for(page = (new_brk + FOUR_KB - 1) & ~(FOUR_KB - 1); page < old_brk; page += FOUR_KB) {
+        unmap_task_frame(pcb->pid, (void*) page);
+    }
+    paging_batch_end();
+
+    pcb->brk = new_brk;
+    return old_brk;
+}
+
 /*
  * do_syscall(int32_t number, int32_t arg1, int32_t arg2, int32_t arg3)
  * Decsription: assembly for doing the call
@@ -508,3 +700,58 @@ int32_t do_syscall(int32_t number, int32_t arg1, int32_t arg2, int32_t arg3) {
 int32_t do_execute(uint8_t *command) {
   return do_syscall(SYSCALL_EXECUTE_NUM, (uint32_t) command, 0, 0);
 }
+
+/*
+ * init_sysenter()
+ * Decsription: Sets up the MSRs sysenter loads its code segment, stack and
+ *              entry point from, so user programs can make system calls
+ *              without going through the IDT. sysexit derives the user
+ *              segments from the kernel code segment, which the GDT lays out
+ *              to match. int 0x80 keeps working either way, and user
+ *              programs check CPUID themselves to fall back on it
+ * Inputs: none
+ * Outputs: none
+ */
+void init_sysenter() {
+    if(!(cpuid_features() & CPUID_SEP)) {
+        log(WARN, "CPU doesn't support sysenter, programs will use int 0x80", "init_sysenter");
+        return;
+    }
+
+    wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t) sysenter_stack_top);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+}
+
+/*
+ * syscall_bench()
+ * Decsription: Times a null system call (sigreturn, which returns right away)
+ *              with the kernel's 4MB page uncached, as it used to be mapped,
+ *              and write-back cached, and prints the average cycles of each
+ * Inputs: none
+ * Outputs: none
+ */
+void syscall_bench() {
+    uint64_t start, end;
+    uint32_t i;
+
+    cli();
+
+    remap_kernel_page(MEM_UNCACHED);
+    start = rdtsc();
+    for(i = 0; i < SYSCALL_BENCH_ITERS; i++) {
+        do_syscall(SYSCALL_SIGRETURN_NUM, 0, 0, 0);
+    }
+    end = rdtsc();
+    printf("null syscall, kernel uncached: %u cycles\n", ((uint32_t) (end - start)) / SYSCALL_BENCH_ITERS);
+
+    remap_kernel_page(mem_type_of((void*) FOUR_MB));
+    start = rdtsc();
+    for(i = 0; i < SYSCALL_BENCH_ITERS; i++) {
+        do_syscall(SYSCALL_SIGRETURN_NUM, 0, 0, 0);
+    }
+    end = rdtsc();
+    printf("null syscall, kernel write-back: %u cycles\n", ((uint32_t) (end - start)) / SYSCALL_BENCH_ITERS);
+
+    sti();
+}
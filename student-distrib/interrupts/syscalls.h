@@ -20,6 +20,40 @@
 #define EXE_HEADER_ENTRY_IDX      6
 #define EXE_HEADER_MAGICNUM_IDX   0
 
+// Address programs are linked to run at, and where their image is loaded
+#define EXE_LOAD_ADDR             0x08048000
+
+/*
+ * Set to 1 to map the read-only pages of an executable straight out of the
+ * filesystem image instead of copying the whole file into the program window.
+ * Falls back to copying when the image can't be mapped.
+ */
+#define EXE_MAP_IMAGE             1
+
+// Page fault error code bit set when the page was present (a protection violation)
+#define PF_PROTECTION             0x1
+
+// ELF header fields used to find the program headers
+#define ELF_HEADER_LEN            52
+#define ELF_PHOFF_OFFSET          28
+#define ELF_PHENTSIZE_OFFSET      42
+#define ELF_PHNUM_OFFSET          44
+#define ELF_MAX_PHDRS             8
+#define ELF_PT_LOAD               1
+#define ELF_PF_W                  0x2
+
+// ELF program header
+typedef struct {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} elf_phdr_t;
+
 #define SYSCALL_HALT_NUM          1
 #define SYSCALL_EXECUTE_NUM       2
 #define SYSCALL_READ_NUM          3
@@ -30,6 +64,31 @@
 #define SYSCALL_VIDMAP_NUM        8
 #define SYSCALL_SETHANDLER_NUM    9
 #define SYSCALL_SIGRETURN_NUM     10
+#define SYSCALL_READV_NUM         11
+#define SYSCALL_WRITEV_NUM        12
+#define SYSCALL_SBRK_NUM          13
+
+// Most buffers one readv or writev call takes
+#define IOV_MAX                   16
+
+// One buffer of a readv or writev call
+typedef struct {
+    void* base;
+    uint32_t len;
+} iovec_t;
+
+// System calls timed by syscall_bench
+#define SYSCALL_BENCH_ITERS 1000
+
+// CPUID flag for sysenter/sysexit, and the MSRs setting up where sysenter goes
+#define CPUID_SEP                 (1 << 11)
+#define MSR_SYSENTER_CS           0x174
+#define MSR_SYSENTER_ESP          0x175
+#define MSR_SYSENTER_EIP          0x176
+
+// Declared in interrupts_asm.S
+extern void sysenter_entry();
+extern uint8_t sysenter_stack_top[];
 
 // halt
 int32_t sys_halt(uint8_t status);
@@ -61,10 +120,31 @@ int32_t sys_set_handler(int32_t signum, void* handler_address);
 // sigreturn
 int32_t sys_sigreturn(void);
 
+// read into several buffers
+int32_t sys_readv(int32_t fd, const iovec_t* iov, int32_t iovcnt);
+
+// write from several buffers
+int32_t sys_writev(int32_t fd, const iovec_t* iov, int32_t iovcnt);
+
+// map in a page of the program window on first touch
+int32_t user_page_fault(uint32_t addr, uint32_t error_code);
+
+// grow or shrink the heap
+int32_t sys_sbrk(int32_t increment);
+
+// load a program into a new task
+pcb_t* spawn_task(const uint8_t* command, uint32_t terminal, uint32_t parent_pid);
+
 // execute call
 int32_t do_syscall(int32_t number, int32_t arg1, int32_t arg2, int32_t arg3);
 
 // execute
 int32_t do_execute(uint8_t *command);
 
+// point sysenter at the system call handler
+void init_sysenter();
+
+// time a null system call with the kernel page uncached and cached
+void syscall_bench();
+
 #endif // SYSCALLS_H
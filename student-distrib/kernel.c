@@ -14,6 +14,8 @@
 #include "devices/terminal.h"
 #include "devices/filesys.h"
 #include "devices/pit.h"
+#include "exe_cache.h"
+#include "kmalloc.h"
 #include "log.h"
 
 /* Macros. */
@@ -26,6 +28,7 @@ void entry (unsigned long magic, unsigned long addr) {
     uint32_t fs_start_addr;
 
     /* Clear the screen. */
+    init_scrollback();
     clear();
 
     /* Am I booted by a Multiboot-compliant boot loader? */
@@ -173,8 +176,14 @@ void entry (unsigned long magic, unsigned long addr) {
 
     init_idt(); // Initialize interrupt handlers
 
+    init_sysenter(); // Set up the fast system call entry
+
+    init_frames(mbi); // Initialize the physical frame allocator (uses mbi, so before paging)
+
     init_paging(); // Initialize paging
 
+    init_kmalloc(); // Initialize the kernel object caches (needs frames)
+
     rtc_init(); // Initialize RTC
 
     init_kernel_file_array(); // Init file descriptor array for the kernel
@@ -191,6 +200,20 @@ void entry (unsigned long magic, unsigned long addr) {
     /**
      * TEST CODE
 
+    fs_bench(); // Cycle counts for read_data over every file
+
+    fs_print_index_stats(); // Name lookups so far and their hit latency
+
+    exe_cache_print_stats(); // Executable cache hits and misses so far
+
+    kmem_print_stats(); // Objects and slabs of each kernel object cache
+
+    paging_bench(); // Cycle counts for vidmap remaps and terminal switches
+
+    syscall_bench(); // Null syscall latency with the kernel uncached and cached
+
+    terminal_bench(); // Throughput of cat-ing a large file to the screen
+
     fs_test(); // Test the filesystem
 
     // Test the terminal driver
@@ -223,12 +246,7 @@ void entry (unsigned long magic, unsigned long addr) {
     printf("%s\n", 0xDEADBEEF);
      */
 
-    // Execute the first shell!
+    // Queue the first shell, then become the idle task
     do_execute((uint8_t *)"shell");
-
-    // We should never reach here, other than in debugging
-    log(ERROR, "Reached EOK (end-of-kernel)", "entry");
-
-    // Spin (nicely, so we don't chew up cycles)
-    asm volatile (".1hlt: hlt; jmp .1hlt;");
+    task_idle();
 }
@@ -0,0 +1,260 @@
+/**
+ * kmalloc.c
+ *
+ * vim:ts=4 expandtab
+ */
+#include "kmalloc.h"
+#include "lib.h"
+#include "log.h"
+
+// Every cache there is. kmalloc's size classes come first
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+static uint32_t num_caches = 0;
+
+// Names of the kmalloc size classes
+static const char* kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+
+/*
+ * init_kmalloc()
+ * Decsription: Creates a cache for each kmalloc size class. The frame
+ *              allocator and paging must be set up first
+ * Inputs: none
+ * Outputs: none
+ */
+void init_kmalloc() {
+    int i;
+    for(i = 0; i < KMALLOC_CLASSES; i++) {
+        kmem_cache_create(kmalloc_names[i], 1 << (KMALLOC_MIN_SHIFT + i));
+    }
+}
+
+/*
+ * kmem_cache_create(const char* name, uint32_t size)
+ * Decsription: Makes a cache handing out objects of one size. Caches last
+ *              forever, so this is meant to be called while booting
+ * Inputs: name - shown by kmem_print_stats, size - bytes in each object
+ * Outputs: the cache, or NULL if there are too many or size doesn't fit a slab
+ */
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size) {
+    size = (size + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+    if(size < sizeof(void*)) {
+        size = sizeof(void*);
+    }
+
+    uint32_t header = (sizeof(kmem_slab_t) + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+    if(num_caches == KMEM_MAX_CACHES || size > KMEM_SLAB_SIZE - header) {
+        log(ERROR, "Can't create cache", "kmem_cache_create");
+        return NULL;
+    }
+
+    kmem_cache_t* cache = &caches[num_caches++];
+    memset(cache, 0x00, sizeof(kmem_cache_t));
+    cache->name = name;
+    cache->obj_size = size;
+    cache->objs_per_slab = (KMEM_SLAB_SIZE - header) / size;
+    return cache;
+}
+
+/*
+ * kmem_slab_unlink(kmem_cache_t* cache, kmem_slab_t* slab)
+ * Decsription: Takes a slab off its cache's list of slabs with free objects
+ * Inputs: cache - the slab's cache, slab - slab on the list
+ * Outputs: none
+ */
+static void kmem_slab_unlink(kmem_cache_t* cache, kmem_slab_t* slab) {
+    if(slab->prev == NULL) {
+        cache->partial = slab->next;
+    } else {
+        slab->prev->next = slab->next;
+    }
+    if(slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+/*
+ * kmem_slab_push(kmem_cache_t* cache, kmem_slab_t* slab)
+ * Decsription: Puts a slab at the front of its cache's list of slabs with free objects
+ * Inputs: cache - the slab's cache, slab - slab not on the list
+ * Outputs: none
+ */
+static void kmem_slab_push(kmem_cache_t* cache, kmem_slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = cache->partial;
+    if(cache->partial != NULL) {
+        cache->partial->prev = slab;
+    }
+    cache->partial = slab;
+}
+
+/*
+ * kmem_slab_new(kmem_cache_t* cache)
+ * Decsription: Gets a slab from the frame allocator and chains all of its
+ *              objects onto its free list
+ * Inputs: cache - cache the slab is for
+ * Outputs: the empty slab, or NULL if out of memory
+ */
+static kmem_slab_t* kmem_slab_new(kmem_cache_t* cache) {
+    kmem_slab_t* slab = frame_alloc(KMEM_SLAB_FRAMES, KMEM_SLAB_FRAMES);
+    if(slab == NULL) {
+        return NULL;
+    }
+
+    memset(slab, 0x00, sizeof(kmem_slab_t));
+    slab->cache = cache;
+
+    uint32_t header = (sizeof(kmem_slab_t) + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+    uint8_t* obj = ((uint8_t*) slab) + header;
+
+    // Chain back to front, so objects are handed out in address order
+    int32_t i;
+    for(i = cache->objs_per_slab - 1; i >= 0; i--) {
+        void** next = (void**) (obj + (i * cache->obj_size));
+        *next = slab->free;
+        slab->free = next;
+    }
+
+    cache->slabs++;
+    cache->empty_slabs++;
+    return slab;
+}
+
+/*
+ * kmem_cache_alloc(kmem_cache_t* cache)
+ * Decsription: Takes a free object from a cache, getting another slab for
+ *              it only if every slab is full. The object isn't cleared
+ * Inputs: cache - cache to take from
+ * Outputs: the object, or NULL if out of memory
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    uint32_t flags;
+    cli_and_save(flags);
+
+    kmem_slab_t* slab = cache->partial;
+    if(slab == NULL) {
+        slab = kmem_slab_new(cache);
+        if(slab == NULL) {
+            restore_flags(flags);
+            log(ERROR, "No memory for a slab", "kmem_cache_alloc");
+            return NULL;
+        }
+        kmem_slab_push(cache, slab);
+    }
+
+    void** obj = slab->free;
+    slab->free = *obj;
+    if(slab->in_use++ == 0) {
+        cache->empty_slabs--;
+    }
+    if(slab->free == NULL) {
+        kmem_slab_unlink(cache, slab);
+    }
+
+    cache->active++;
+    cache->allocs++;
+
+    restore_flags(flags);
+    return obj;
+}
+
+/*
+ * kmem_cache_free(kmem_cache_t* cache, void* obj)
+ * Decsription: Gives an object back to its slab. Only the first word of the
+ *              object is overwritten until it is handed out again. A slab
+ *              left empty goes back to the frame allocator if the cache
+ *              already has an empty one
+ * Inputs: cache - cache the object came from, obj - object from kmem_cache_alloc
+ * Outputs: none
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    if(obj == NULL) {
+        return;
+    }
+
+    kmem_slab_t* slab = (kmem_slab_t*) (((uint32_t) obj) & ~(KMEM_SLAB_SIZE - 1));
+    if(slab->cache != cache) {
+        log(ERROR, "Object doesn't belong to the cache", "kmem_cache_free");
+        return;
+    }
+
+    uint32_t flags;
+    cli_and_save(flags);
+
+    if(slab->free == NULL) {
+        kmem_slab_push(cache, slab); // Was full, so it wasn't on the list
+    }
+    *((void**) obj) = slab->free;
+    slab->free = obj;
+
+    cache->active--;
+    cache->frees++;
+
+    if(--slab->in_use == 0) {
+        if(cache->empty_slabs > 0) {
+            kmem_slab_unlink(cache, slab);
+            frame_free(slab, KMEM_SLAB_FRAMES);
+            cache->slabs--;
+        } else {
+            cache->empty_slabs++;
+        }
+    }
+
+    restore_flags(flags);
+}
+
+/*
+ * kmalloc(uint32_t size)
+ * Decsription: Allocates memory from the smallest size class that fits
+ * Inputs: size - bytes needed, up to KMALLOC_MAX
+ * Outputs: the memory (not cleared), or NULL if size is 0, too large or memory ran out
+ */
+void* kmalloc(uint32_t size) {
+    if(size == 0 || size > KMALLOC_MAX) {
+        log(WARN, "Invalid kmalloc size", "kmalloc");
+        return NULL;
+    }
+
+    uint32_t class = 0;
+    while((1 << (KMALLOC_MIN_SHIFT + class)) < size) {
+        class++;
+    }
+    return kmem_cache_alloc(&caches[class]);
+}
+
+/*
+ * kfree(void* ptr)
+ * Decsription: Frees memory from kmalloc, or any other cache, as the slab
+ *              header says which cache it came from
+ * Inputs: ptr - memory to free, or NULL
+ * Outputs: none
+ */
+void kfree(void* ptr) {
+    if(ptr == NULL) {
+        return;
+    }
+
+    kmem_slab_t* slab = (kmem_slab_t*) (((uint32_t) ptr) & ~(KMEM_SLAB_SIZE - 1));
+    kmem_cache_free(slab->cache, ptr);
+}
+
+/*
+ * kmem_print_stats()
+ * Decsription: Prints how many objects of each cache are in use and how
+ *              many slabs hold them
+ * Inputs: none
+ * Outputs: none
+ */
+void kmem_print_stats() {
+    uint32_t i;
+    for(i = 0; i < num_caches; i++) {
+        kmem_cache_t* cache = &caches[i];
+        printf("%s (%u bytes): %u active, %u allocs, %u frees, %u slabs\n",
+                cache->name, cache->obj_size, cache->active, cache->allocs,
+                cache->frees, cache->slabs);
+    }
+}
@@ -0,0 +1,77 @@
+/**
+ * kmalloc.h
+ *
+ * vim:ts=4 expandtab
+ */
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include "types.h"
+#include "frames.h"
+
+/*
+ * Objects are carved out of slabs: KMEM_SLAB_SIZE blocks from the frame
+ * allocator, aligned to their size, with a kmem_slab_t header at the start.
+ * The slab of an object is found by rounding its address down, so freeing
+ * takes constant time, as does allocating from a slab with room left
+ */
+#define KMEM_SLAB_FRAMES 4
+#define KMEM_SLAB_SIZE   (KMEM_SLAB_FRAMES * FRAME_SIZE)
+
+// Objects are rounded up to a multiple of this
+#define KMEM_ALIGN 8
+
+// Most caches that can exist at once, counting kmalloc's
+#define KMEM_MAX_CACHES 16
+
+// kmalloc size classes: 16, 32, ... 2048 bytes. Larger memory comes from frame_alloc
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_CLASSES   8
+#define KMALLOC_MAX       (1 << (KMALLOC_MIN_SHIFT + KMALLOC_CLASSES - 1))
+
+struct kmem_cache;
+
+// Header of a slab, at its start
+typedef struct kmem_slab {
+    struct kmem_cache* cache;
+    struct kmem_slab* prev;   // Neighbours on the cache's list of slabs with free objects
+    struct kmem_slab* next;
+    void* free;               // First free object, each holding a pointer to the next
+    uint32_t in_use;          // Objects handed out
+} kmem_slab_t;
+
+// Objects of one size, and how they have been used
+typedef struct kmem_cache {
+    const char* name;
+    uint32_t obj_size;
+    uint32_t objs_per_slab;
+    kmem_slab_t* partial;     // Slabs with at least one free object
+    uint32_t empty_slabs;     // Slabs with nothing in use. One is kept around, the rest freed
+    uint32_t slabs;           // Slabs taken from the frame allocator
+    uint32_t active;          // Objects in use
+    uint32_t allocs;
+    uint32_t frees;
+} kmem_cache_t;
+
+// set up the kmalloc size classes
+void init_kmalloc();
+
+// make a cache of objects of one size
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size);
+
+// take an object from a cache
+void* kmem_cache_alloc(kmem_cache_t* cache);
+
+// give an object back to its cache
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+// allocate up to KMALLOC_MAX bytes
+void* kmalloc(uint32_t size);
+
+// free memory from kmalloc
+void kfree(void* ptr);
+
+// print the counters of every cache
+void kmem_print_stats();
+
+#endif /* KMALLOC_H */
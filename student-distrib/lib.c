@@ -9,30 +9,124 @@
 
 #define TAB_SPACES 4
 
-static int screen_x;
-static int screen_y;
+#if SCROLLBACK_LINES <= NUM_ROWS
+#error "SCROLLBACK_LINES must be more than a screen"
+#endif
+
+// Text memory cell of a space, as a character byte followed by an attribute byte
+#define BLANK_CELL ((ATTRIB << 8) | ' ')
+
+// Cursor position of each terminal
+static int screen_x[NUM_TERMINALS];
+static int screen_y[NUM_TERMINALS];
 static char* video_mem = (char *)VIDEO;
 
+/*
+ * Text of each terminal, as a ring of SCROLLBACK_LINES lines. The NUM_ROWS
+ * lines starting at scrollback_top make up its screen, and the lines before
+ * them are its history. Output goes into the ring, and only the part on
+ * show is copied into the terminal's video memory
+ */
+static uint16_t scrollback[NUM_TERMINALS][SCROLLBACK_LINES][NUM_COLS];
+
+// Ring index of the line on the top row of each terminal's screen
+static uint32_t scrollback_top[NUM_TERMINALS];
+
+// Lines of history kept above each terminal's screen
+static uint32_t scrollback_count[NUM_TERMINALS];
+
+// How far each terminal is scrolled back through its history, 0 when it shows its screen
+static uint32_t scrollback_view[NUM_TERMINALS];
+
+// Screen cells changed by an output call, so they can be shown all at once afterwards
+typedef struct {
+	int first;
+	int last;
+	int scrolled;
+} dirty_cells_t;
+
 
 
+/*
+* uint16_t* screen_line(uint32_t terminal, int row);
+*   Inputs: uint32_t terminal = terminal
+*			int row = row of the terminal's screen
+*   Return Value: the line of the ring on that row
+*	Function: Finds where a row of a terminal's screen lives in its ring
+*/
+
+static inline uint16_t*
+screen_line(uint32_t terminal, int row)
+{
+	return scrollback[terminal][(scrollback_top[terminal] + row) % SCROLLBACK_LINES];
+}
+
+/*
+* void render_cells(uint32_t terminal, int first, int last);
+*   Inputs: uint32_t terminal = terminal to show
+*			int first, int last = range of screen cells, row * NUM_COLS + column
+*   Return Value: none
+*	Function: Copies part of what a terminal's view shows, its screen or the
+*	          history it is scrolled back to, from its ring into its video memory
+*/
+
+static void
+render_cells(uint32_t terminal, int first, int last)
+{
+	uint16_t* video = (uint16_t*) get_terminal_video_mem(terminal);
+	uint32_t top = scrollback_top[terminal] + SCROLLBACK_LINES - scrollback_view[terminal];
+	int row;
+	for(row = first / NUM_COLS; row <= last / NUM_COLS; row++) {
+		int start = (row == first / NUM_COLS) ? first % NUM_COLS : 0;
+		int end = (row == last / NUM_COLS) ? last % NUM_COLS : NUM_COLS - 1;
+		uint16_t* line = scrollback[terminal][(top + row) % SCROLLBACK_LINES];
+		memcpy(video + row * NUM_COLS + start, line + start, (end - start + 1) * sizeof(uint16_t));
+	}
+}
+
+/*
+* void init_scrollback(void);
+*   Inputs: void
+*   Return Value: none
+*	Function: Blanks the text, history and screen of every terminal
+*/
+
+void
+init_scrollback(void)
+{
+	uint32_t t;
+	for(t = 0; t < NUM_TERMINALS; t++) {
+		memset_word(scrollback[t], BLANK_CELL, SCROLLBACK_LINES * NUM_COLS);
+		scrollback_top[t] = 0;
+		scrollback_count[t] = 0;
+		scrollback_view[t] = 0;
+		screen_x[t] = 0;
+		screen_y[t] = 0;
+		render_cells(t, 0, NUM_ROWS * NUM_COLS - 1);
+	}
+}
+
 /*
 * void clear(void);
 *   Inputs: void
 *   Return Value: none
-*	Function: Clears video memory
+*	Function: Clears the screen of the terminal on show. Its history is kept
 */
 
 void
 clear(void)
 {
-    int32_t i;
-    for(i=0; i<NUM_ROWS*NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
-    }
+	uint32_t t = current_terminal;
+	int row;
+	for(row = 0; row < NUM_ROWS; row++) {
+		memset_word(screen_line(t, row), BLANK_CELL, NUM_COLS);
+	}
+
+	scrollback_view[t] = 0;
+	render_cells(t, 0, NUM_ROWS * NUM_COLS - 1);
 
-	screen_x = 0;
-	screen_y = 0;
+	screen_x[t] = 0;
+	screen_y[t] = 0;
 }
 
 
@@ -184,29 +278,12 @@ puts(int8_t* s)
 	return index;
 }
 
-void scroll_down(void) {
-  int row, col;
-  for (row = 0; row < NUM_ROWS; row++) {
-    for (col = 0; col < NUM_COLS; col++) {
-      if (row != 0) {
-        *(uint8_t *)(video_mem + ((NUM_COLS*(row - 1) + col) << 1)) = *(uint8_t *)(video_mem + ((NUM_COLS*(row) + col) << 1));
-        *(uint8_t *)(video_mem + ((NUM_COLS*(row - 1) + col) << 1) + 1) = ATTRIB;
-      }
-    }
-  }
-
-  // Clear last row
-  for (col = 0; col < NUM_COLS; col++) {
-    *(uint8_t *)(video_mem + ((NUM_COLS*(NUM_ROWS - 1) + col) << 1)) = ' ';
-    *(uint8_t *)(video_mem + ((NUM_COLS*(NUM_ROWS - 1) + col) << 1) + 1) = ATTRIB;
-  }
-}
-
 // Sets the location of the blinking cursor
 // @param row row
 // @param col column
 void set_cursor(int row, int col) {
-  uint16_t position = row * NUM_COLS + col;
+  // The cursor position counts from the start of VGA memory, not the screen on show
+  uint16_t position = current_terminal * TERMINAL_SCREEN_CELLS + row * NUM_COLS + col;
 
   outb(0x0F, 0x3D4);
   outb((uint8_t)(position & 0xFF), 0x3D5); // Write first part of position
@@ -218,58 +295,276 @@ void set_cursor(int row, int col) {
 * void putc(uint8_t c);
 *   Inputs: uint_8* c = character to print
 *   Return Value: void
-*	Function: Output a character to the console
+*	Function: Output a character to the console of the running task's
+*	          terminal (the one on screen if no task is running)
 */
 
 void
 putc(uint8_t c)
 {
-    if(c == '\n' || c == '\r') {
-        screen_y++;
-        screen_x=0;
+	pcb_t* pcb = get_pcb_ptr();
+	putc_terminal((pcb == NULL) ? current_terminal : pcb->terminal_index, c);
+}
 
-        if (screen_y >= NUM_ROWS) {
-          scroll_down();
-          screen_y--;
-        }
+/*
+* void scroll_terminal(uint32_t terminal);
+*   Inputs: uint32_t terminal = terminal to scroll
+*   Return Value: void
+*	Function: Moves a terminal's screen down its ring by a line, turning the
+*	          top line into history and blanking a new bottom line. A view
+*	          scrolled back into the history stays on the same lines
+*/
+
+static void
+scroll_terminal(uint32_t terminal)
+{
+	scrollback_top[terminal] = (scrollback_top[terminal] + 1) % SCROLLBACK_LINES;
+	if(scrollback_count[terminal] < SCROLLBACK_LINES - NUM_ROWS) {
+		scrollback_count[terminal]++;
+	}
+	if(scrollback_view[terminal] != 0 && scrollback_view[terminal] < scrollback_count[terminal]) {
+		scrollback_view[terminal]++;
+	}
+
+	memset_word(screen_line(terminal, NUM_ROWS - 1), BLANK_CELL, NUM_COLS);
+}
+
+/*
+* void mark_dirty(dirty_cells_t* dirty, int x, int y);
+*   Inputs: dirty_cells_t* dirty = cells changed so far
+*			int x, int y = cell that changed
+*   Return Value: void
+*	Function: Adds a cell to the range that needs showing
+*/
+
+static inline void
+mark_dirty(dirty_cells_t* dirty, int x, int y)
+{
+	int cell = y * NUM_COLS + x;
+	if(cell < dirty->first) {
+		dirty->first = cell;
+	}
+	if(cell > dirty->last) {
+		dirty->last = cell;
+	}
+}
+
+/*
+* void render_char(uint32_t terminal, int* x, int* y, uint8_t c, dirty_cells_t* dirty);
+*   Inputs: uint32_t terminal = terminal to print to
+*			int* x, int* y = cursor position, updated
+*			uint_8* c = character to print
+*			dirty_cells_t* dirty = cells changed so far, updated
+*   Return Value: void
+*	Function: Puts one character into a terminal's ring at the cursor and
+*	          moves the cursor past it, scrolling if needed. Nothing is shown
+*	          until show_dirty is called
+*/
+
+static void
+render_char(uint32_t terminal, int* x, int* y, uint8_t c, dirty_cells_t* dirty)
+{
+    if(c == '\n' || c == '\r') {
+        (*y)++;
+        *x=0;
     } else if (c == '\t') {
-        screen_x += TAB_SPACES;
-        screen_x %= NUM_COLS;
+        *x += TAB_SPACES;
+        *x %= NUM_COLS;
     } else if (c == '\b') {
-        screen_x--;
-        if (screen_x < 0) {
-          screen_x = NUM_COLS - 1;
-          screen_y--;
-          if (screen_y < 0) {
-            screen_y = 0;
+        (*x)--;
+        if (*x < 0) {
+          *x = NUM_COLS - 1;
+          (*y)--;
+          if (*y < 0) {
+            *y = 0;
           }
         }
-        screen_x %= NUM_COLS;
+        *x %= NUM_COLS;
         // Clear char
-        *(uint8_t *)(video_mem + ((NUM_COLS*screen_y + screen_x) << 1)) = ' ';
-        *(uint8_t *)(video_mem + ((NUM_COLS*screen_y + screen_x) << 1) + 1) = ATTRIB;
+        screen_line(terminal, *y)[*x] = BLANK_CELL;
+        mark_dirty(dirty, *x, *y);
     } else {
-        *(uint8_t *)(video_mem + ((NUM_COLS*screen_y + screen_x) << 1)) = c;
-        *(uint8_t *)(video_mem + ((NUM_COLS*screen_y + screen_x) << 1) + 1) = ATTRIB;
-        screen_x++;
-
-        if (screen_x == NUM_COLS) {
-          screen_x = 0;
-          screen_y++;
-        }
+        screen_line(terminal, *y)[*x] = (ATTRIB << 8) | c;
+        mark_dirty(dirty, *x, *y);
+        (*x)++;
 
-        if (screen_y >= NUM_ROWS) {
-          scroll_down();
-          screen_y--;
+        if (*x == NUM_COLS) {
+          *x = 0;
+          (*y)++;
         }
+    }
 
+    if (*y >= NUM_ROWS) {
+      scroll_terminal(terminal);
+      dirty->scrolled = 1;
+      (*y)--;
     }
+}
 
-	// Only set the cursor if this is the active task for the current terminal
-	pcb_t* pcb = get_pcb_ptr();
-	if(pcb == NULL || active_pids[current_terminal] == pcb->pid) {
-		set_cursor(screen_y, screen_x);
+/*
+* void show_dirty(uint32_t terminal, dirty_cells_t* dirty);
+*   Inputs: uint32_t terminal = terminal printed to
+*			dirty_cells_t* dirty = cells changed
+*   Return Value: void
+*	Function: Copies what output changed into the terminal's video memory.
+*	          After a scroll that is the whole screen, but still only once
+*	          however many lines went by. Nothing is copied while the view
+*	          is scrolled back, as the output is off the bottom of it
+*/
+
+static void
+show_dirty(uint32_t terminal, dirty_cells_t* dirty)
+{
+	if(scrollback_view[terminal] != 0) {
+		return;
+	}
+
+	if(dirty->scrolled) {
+		render_cells(terminal, 0, NUM_ROWS * NUM_COLS - 1);
+	} else if(dirty->first <= dirty->last) {
+		render_cells(terminal, dirty->first, dirty->last);
+	}
+}
+
+/*
+* void putc_terminal(uint32_t terminal, uint8_t c);
+*   Inputs: uint32_t terminal = terminal to print to
+*			uint_8* c = character to print
+*   Return Value: void
+*	Function: Output a character to a terminal, whether or not it is on screen
+*/
+
+void
+putc_terminal(uint32_t terminal, uint8_t c)
+{
+	dirty_cells_t dirty = {NUM_ROWS * NUM_COLS, -1, 0};
+	uint32_t flags;
+
+	cli_and_save(flags);
+	render_char(terminal, &screen_x[terminal], &screen_y[terminal], c, &dirty);
+	show_dirty(terminal, &dirty);
+
+	// Only move the hardware cursor for the terminal on screen
+	if(terminal == current_terminal && scrollback_view[terminal] == 0) {
+		set_cursor(screen_y[terminal], screen_x[terminal]);
+	}
+	restore_flags(flags);
+}
+
+/*
+* int32_t write_terminal(uint32_t terminal, const uint8_t* buf, int32_t n);
+*   Inputs: uint32_t terminal = terminal to print to
+*			const uint8_t* buf = characters to print
+*			int32_t n = number of characters
+*   Return Value: number of characters printed
+*	Function: Output a whole buffer to a terminal. Runs of ordinary
+*	          characters are stored straight into the ring a row at a time,
+*	          scrolling just moves the ring's top line, and the result is
+*	          copied to video memory and the hardware cursor moved once at
+*	          the end. Interrupts are held off so keyboard echo can't land
+*	          in the middle of the buffer
+*/
+
+int32_t
+write_terminal(uint32_t terminal, const uint8_t* buf, int32_t n)
+{
+	dirty_cells_t dirty = {NUM_ROWS * NUM_COLS, -1, 0};
+	uint32_t flags;
+	int32_t i = 0;
+
+	cli_and_save(flags);
+	int x = screen_x[terminal];
+	int y = screen_y[terminal];
+
+	while(i < n) {
+		uint8_t c = buf[i];
+		if(c == '\n' || c == '\r' || c == '\t' || c == '\b') {
+			render_char(terminal, &x, &y, c, &dirty);
+			i++;
+			continue;
+		}
+
+		// Copy characters up to the next control character or the end of the row
+		uint16_t* cell = screen_line(terminal, y) + x;
+		int run = 0;
+		while(i < n && x + run < NUM_COLS) {
+			c = buf[i];
+			if(c == '\n' || c == '\r' || c == '\t' || c == '\b') {
+				break;
+			}
+			cell[run++] = (ATTRIB << 8) | c;
+			i++;
+		}
+
+		if(run > 0) {
+			mark_dirty(&dirty, x, y);
+			mark_dirty(&dirty, x + run - 1, y);
+		}
+
+		x += run;
+		if(x == NUM_COLS) {
+			x = 0;
+			y++;
+			if(y >= NUM_ROWS) {
+				scroll_terminal(terminal);
+				dirty.scrolled = 1;
+				y--;
+			}
+		}
+	}
+
+	screen_x[terminal] = x;
+	screen_y[terminal] = y;
+	show_dirty(terminal, &dirty);
+
+	// Only move the hardware cursor for the terminal on screen
+	if(terminal == current_terminal && scrollback_view[terminal] == 0) {
+		set_cursor(y, x);
 	}
+	restore_flags(flags);
+
+	return n;
+}
+
+/*
+* void scroll_view(uint32_t terminal, int32_t lines);
+*   Inputs: uint32_t terminal = terminal to scroll
+*			int32_t lines = lines to go back through the history, or
+*			                forward towards the screen if negative
+*   Return Value: void
+*	Function: Scrolls the view of a terminal through its history, as far as
+*	          the oldest line kept and back to its screen. The hardware
+*	          cursor is hidden while the view is away from the screen
+*/
+
+void
+scroll_view(uint32_t terminal, int32_t lines)
+{
+	uint32_t flags;
+	cli_and_save(flags);
+
+	int32_t view = (int32_t) scrollback_view[terminal] + lines;
+	if(view < 0) {
+		view = 0;
+	}
+	if(view > (int32_t) scrollback_count[terminal]) {
+		view = scrollback_count[terminal];
+	}
+
+	if(view != scrollback_view[terminal]) {
+		scrollback_view[terminal] = view;
+		render_cells(terminal, 0, NUM_ROWS * NUM_COLS - 1);
+
+		if(terminal == current_terminal) {
+			if(view == 0) {
+				set_cursor(screen_y[terminal], screen_x[terminal]);
+			} else {
+				set_cursor(NUM_ROWS, 0); // Past the end of the screen, so not shown
+			}
+		}
+	}
+
+	restore_flags(flags);
 }
 
 /*
@@ -661,9 +956,11 @@ int32_t log2_of_pwr2(int32_t pwr2) {
  * Output: none
  */
 void reset_screen_pos() {
-	screen_x = switch_screen_pos_x[current_terminal];
-	screen_y = switch_screen_pos_y[current_terminal];
-	set_cursor(screen_y, screen_x);
+	if(scrollback_view[current_terminal] != 0) {
+		set_cursor(NUM_ROWS, 0); // Scrolled back, so the cursor is off the view
+	} else {
+		set_cursor(screen_y[current_terminal], screen_x[current_terminal]);
+	}
 }
 
 /*
@@ -673,7 +970,7 @@ void reset_screen_pos() {
  * Output: x coordinate
  */
 int get_screen_x() {
-	return screen_x;
+	return screen_x[current_terminal];
 }
 
 /*
@@ -683,6 +980,6 @@ int get_screen_x() {
  * Output: y coordinate
  */
 int get_screen_y() {
-	return screen_y;
+	return screen_y[current_terminal];
 }
 
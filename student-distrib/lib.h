@@ -20,19 +20,26 @@
 
 #define VIDEO 0xB8000
 
+// Lines of text each terminal keeps, counting the ones on its screen
+#define SCROLLBACK_LINES 200
+
+// Lines Shift-PgUp/PgDn scroll a terminal's view by
+#define SCROLLBACK_PAGE 12
+
 // Declared in terminal.c
 extern volatile uint32_t current_terminal;
-extern volatile int switch_screen_pos_x[NUM_TERMINALS];
-extern volatile int switch_screen_pos_y[NUM_TERMINALS];
-extern volatile uint32_t active_pids[NUM_TERMINALS];
 
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
+void putc_terminal(uint32_t terminal, uint8_t c);
+int32_t write_terminal(uint32_t terminal, const uint8_t* buf, int32_t n);
 int32_t puts(int8_t *s);
 int8_t *itoa(uint32_t value, int8_t* buf, int32_t radix);
 int8_t *strrev(int8_t* s);
 uint32_t strlen(const int8_t* s);
+void init_scrollback(void);
 void clear(void);
+void scroll_view(uint32_t terminal, int32_t lines);
 int32_t log2_of_pwr2(int32_t pwr2);
 void reset_screen_pos();
 int get_screen_x();
@@ -127,6 +134,71 @@ static inline uint32_t inl(uint32_t port)
 	return val;
 }
 
+/* Reads the processor's time-stamp counter (cycles since reset) */
+static inline uint64_t rdtsc(void)
+{
+	uint64_t val;
+	asm volatile("rdtsc"
+			: "=A"(val)
+			:
+			: "memory" );
+	return val;
+}
+
+/* Reads a model-specific register */
+static inline uint64_t rdmsr(uint32_t msr)
+{
+	uint64_t val;
+	asm volatile("rdmsr"
+			: "=A"(val)
+			: "c"(msr) );
+	return val;
+}
+
+/* Writes a model-specific register */
+static inline void wrmsr(uint32_t msr, uint64_t val)
+{
+	asm volatile("wrmsr"
+			:
+			: "c"(msr), "A"(val)
+			: "memory" );
+}
+
+/* Returns the EDX feature flags of CPUID leaf 1 */
+static inline uint32_t cpuid_features(void)
+{
+	uint32_t eax = 1, ebx, ecx = 0, edx;
+	asm volatile("cpuid"
+			: "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx) );
+	return edx;
+}
+
+/* Returns the index of the lowest set bit of val, which must not be 0 */
+static inline uint32_t bsf(uint32_t val)
+{
+	uint32_t bit;
+	asm("bsfl  %1, %0"
+			: "=r"(bit)
+			: "rm"(val)
+			: "cc" );
+	return bit;
+}
+
+/* Invalidates the TLB entry for the page containing virt */
+static inline void invlpg(void* virt)
+{
+	asm volatile("invlpg (%0)"
+			:
+			: "r"(virt)
+			: "memory" );
+}
+
+/* Keeps the compiler from moving memory accesses across this point */
+#define barrier()                       \
+do {                                    \
+	asm volatile("" : : : "memory");    \
+} while(0)
+
 /* Writes a byte to a port */
 #define outb(data, port)                \
 do {                                    \
@@ -5,11 +5,128 @@
  */
 #include "paging.h"
 
-uint32_t page_dirs[MAX_TASKS + 1][MAX_ENTRIES] __attribute__((aligned(FOUR_KB)));
-uint32_t page_tables[MAX_TASKS + 1][NUM_PAGE_TABLES][MAX_ENTRIES] __attribute__((aligned(FOUR_KB)));
+// The kernel's page directory and page table for [0, 4MB), needed before the frame allocator can be used
+static uint32_t kernel_page_dir[MAX_ENTRIES] __attribute__((aligned(FOUR_KB)));
+static uint32_t kernel_page_table[MAX_ENTRIES] __attribute__((aligned(FOUR_KB)));
 
-// Declared in terminal.c
-extern volatile uint32_t active_pids[NUM_TERMINALS];
+/*
+ * What every task's paging starts out as, built once by init_paging. New
+ * page directories are copies of task_page_dir_template, and all of them
+ * share task_page_table for [0, 4MB), which never changes after boot
+ */
+static uint32_t task_page_dir_template[MAX_ENTRIES] __attribute__((aligned(FOUR_KB)));
+static uint32_t task_page_table[MAX_ENTRIES] __attribute__((aligned(FOUR_KB)));
+
+/*
+ * Page directory of each PID. Those of tasks, and every page table other than
+ * the kernel's first, come from the frame allocator as they are needed
+ */
+uint32_t* page_dirs[MAX_TASKS + 1];
+
+// Whether PAT entry PAT_WC_ENTRY was set up for write-combining
+static uint32_t pat_wc_enabled = 0;
+
+// Page attribute bits that select a memory type
+typedef struct {
+    uint8_t pat;
+    uint8_t cache_disabled;
+    uint8_t write_through;
+} mem_attr_t;
+
+// Open batches of mapping changes, and the pages they still have to flush
+static uint32_t batch_depth = 0;
+static uint32_t batch_count = 0;
+static void* batch_pages[PAGING_BATCH_MAX];
+
+/*
+ *void init_pat()
+ *   Inputs: none
+ *   Return Value: none
+ *   Function: reprograms one entry of the page attribute table for
+ *             write-combining, if the processor has a PAT. The other entries
+ *             keep their power-on types, so PCD/PWT alone mean what they
+ *             always did. Must run before paging is enabled
+ */
+static void init_pat() {
+    if(!(cpuid_features() & CPUID_PAT)) {
+        log(INFO, "No PAT, video memory will be uncached", "init_pat");
+        return;
+    }
+
+    uint64_t pat = rdmsr(MSR_PAT);
+    pat &= ~(((uint64_t) 0xFF) << (PAT_WC_ENTRY * 8));
+    pat |= ((uint64_t) PAT_TYPE_WC) << (PAT_WC_ENTRY * 8);
+    wrmsr(MSR_PAT, pat);
+
+    pat_wc_enabled = 1;
+}
+
+/*
+ *uint32_t mem_type_of(void* phys)
+ *   Inputs:
+ *   -phys = physical address
+ *   Return Value: MEM_WRITE_BACK, MEM_UNCACHED or MEM_WRITE_COMBINING
+ *   Function: the memory type policy. Video memory (including the screens
+ *             of the terminals not on show) is write-combining,
+ *             the rest of the ISA hole is uncached I/O, and everything else
+ *             is RAM, cached write-back
+ */
+uint32_t mem_type_of(void* phys) {
+    uint32_t addr = (uint32_t) phys;
+
+    if(addr >= VGA_MEM_START && addr < VGA_MEM_END) {
+        return MEM_WRITE_COMBINING;
+    }
+    if(addr >= VGA_MEM_END && addr < ISA_HOLE_END) {
+        return MEM_UNCACHED;
+    }
+    return MEM_WRITE_BACK;
+}
+
+/*
+ *mem_attr_t mem_type_attr(uint32_t mem_type)
+ *   Inputs:
+ *   -mem_type = memory type
+ *   Return Value: the PAT, PCD and PWT bits selecting the memory type
+ *   Function: encodes a memory type for a page table or directory entry
+ */
+static mem_attr_t mem_type_attr(uint32_t mem_type) {
+    mem_attr_t attr = {0, 0, 0}; // PAT entry 0: write-back
+
+    if(mem_type == MEM_WRITE_COMBINING && pat_wc_enabled) {
+        attr.pat = 1;             // PAT entry 4: write-combining
+    } else if(mem_type != MEM_WRITE_BACK) {
+        attr.cache_disabled = 1;  // PAT entry 3: uncached
+        attr.write_through = 1;
+    }
+    return attr;
+}
+
+/*
+ *void init_task_template()
+ *   Inputs: none
+ *   Return Value: none
+ *   Function: builds the paging every task starts with: video memory and the
+ *             terminal screens for the kernel only, the kernel's large page
+ *             and the frame allocator's memory. The program window is left
+ *             out, as it is different for each task
+ */
+static void init_task_template() {
+    memset(task_page_dir_template, 0x00, sizeof(task_page_dir_template));
+    memset(task_page_table, 0x00, sizeof(task_page_table));
+
+    // First user page table [0GB, 4MB)
+    register_page_table(task_page_dir_template, 0, task_page_table, ACCESS_SUPER);
+
+    // Map page for video memory in first user page table
+    map_page(task_page_table, ((void*) VIDEO), ((void*) VIDEO), ACCESS_SUPER);
+    map_terminal_screens(task_page_table);
+
+    // Map large page for kernel code
+    map_large_page(task_page_dir_template, ((void*) FOUR_MB), ((void*) FOUR_MB),
+            ACCESS_SUPER, GLOBAL);
+    map_frame_memory(task_page_dir_template);
+}
 
 /*
  *void init_paging()
@@ -18,32 +135,40 @@ extern volatile uint32_t active_pids[NUM_TERMINALS];
  *   Function: begins the whole paging process
  */
 void init_paging() {
-    memset(page_dirs, 0x00, sizeof(uint32_t) * MAX_ENTRIES * (MAX_TASKS + 1));
-    memset(page_tables, 0x00, sizeof(uint32_t) * MAX_ENTRIES * NUM_PAGE_TABLES * (MAX_TASKS + 1));
+    memset(kernel_page_dir, 0x00, sizeof(kernel_page_dir));
+    memset(kernel_page_table, 0x00, sizeof(kernel_page_table));
+    page_dirs[KERNEL_PID] = kernel_page_dir;
+
+    // Needs to happen before any mapping uses the write-combining type
+    init_pat();
 
     // Kernel page table
-    register_page_table(page_dirs[KERNEL_PID], 0, page_tables[KERNEL_PID][0], ACCESS_SUPER);
+    register_page_table(page_dirs[KERNEL_PID], 0, kernel_page_table, ACCESS_SUPER);
 
     // Map page for video memory in kernel page table
-    map_page(page_tables[KERNEL_PID][0], ((void*) VIDEO), ((void*) VIDEO), ACCESS_ALL);
+    map_page(kernel_page_table, ((void*) VIDEO), ((void*) VIDEO), ACCESS_ALL);
+    map_terminal_screens(kernel_page_table);
 
-    // Map large page for kernel code
+    // Map large page for kernel code. It is the same for every task, so keep it across CR3 loads
     map_large_page(page_dirs[KERNEL_PID], ((void*) FOUR_MB), ((void*) FOUR_MB),
-            ACCESS_SUPER, NOT_GLOBAL, CACHE_DISABLED, WRITE_THROUGH_ENABLED);
+            ACCESS_SUPER, GLOBAL);
+    map_frame_memory(page_dirs[KERNEL_PID]);
+
+    init_task_template();
 
     // Enable paging - from OSDev guide at http://wiki.osdev.org/Paging
     asm volatile (
-            "movl $page_dirs, %%eax        /* Load paging directory */      ;"
+            "movl %0, %%eax                /* Load paging directory */      ;"
             "movl %%eax, %%cr3                                              ;"
 
-            "movl %%cr4, %%eax             /* Enable PSE */                 ;"
-            "orl  $0x00000010, %%eax                                        ;"
+            "movl %%cr4, %%eax             /* Enable PSE and PGE */         ;"
+            "orl  $0x00000090, %%eax                                        ;"
             "movl %%eax, %%cr4                                              ;"
 
-            "movl %%cr0, %%eax             /* Set paging bit */             ;"
-            "orl  $0x80000000, %%eax                                        ;"
+            "movl %%cr0, %%eax             /* Set paging and WP bits */     ;"
+            "orl  $0x80010000, %%eax                                        ;"
             "movl %%eax, %%cr0                                              ;"
-            : : : "eax");
+            : : "g"(kernel_page_dir) : "eax");
 }
 
 /*
@@ -63,14 +188,38 @@ void map_page(uint32_t* page_table, void* phys, void* virt, uint8_t access) {
     pt_entry.present = 1;        // Present
     pt_entry.read_write = 1;     // Read/Write
     pt_entry.user_supervisor = access;
-    pt_entry.write_through = 1;  // Write-Through caching enabled
-    pt_entry.cache_disabled = 0; // Caching not disabled
     pt_entry.global = 0;         // Flush TLB if CR3 is reset
+
+    // Caching as mem_type_of says for the memory
+    mem_attr_t attr = mem_type_attr(mem_type_of(phys));
+    pt_entry.pat = attr.pat;
+    pt_entry.cache_disabled = attr.cache_disabled;
+    pt_entry.write_through = attr.write_through;
     pt_entry.addr = ((uint32_t) phys) >> 12;
 
     page_table[(((uint32_t) virt) >> 12) & 0x3FF] = pt_entry.val;
 }
 
+/*
+ *void map_page_readonly(uint32_t* page_table, void* phys, void* virt, uint8_t access)
+ *   Inputs:
+ *   -page_table = page table address
+ *   -phys = physical address
+ *   -virt = virtual address
+ *   -access = access level
+ *   Return Value: none
+ *   Function: maps a page like map_page, but with writes disallowed. Since CR0.WP
+ *             is set, this holds for the kernel as well
+ */
+void map_page_readonly(uint32_t* page_table, void* phys, void* virt, uint8_t access) {
+    map_page(page_table, phys, virt, access);
+
+    pt_entry_t pt_entry;
+    pt_entry.val = page_table[(((uint32_t) virt) >> 12) & 0x3FF];
+    pt_entry.read_write = 0;     // Read-only
+    page_table[(((uint32_t) virt) >> 12) & 0x3FF] = pt_entry.val;
+}
+
 /**
  * unmap_page(uint32_t* page_table, void* virt)
  * Description: unmap a page
@@ -85,29 +234,32 @@ void unmap_page(uint32_t* page_table, void* virt) {
 
 /*
 * void map_large_page(uint32_t* page_dir, void* phys, void* virt,
-        uint8_t access, uint8_t global, uint8_t cache_disabled, uint8_t write_through)
+        uint8_t access, uint8_t global)
 *   Inputs:
     -page_dir = page directory
     -phys = physical address
     -virt = virtual address
     -access = access level
     -global = whether or not to flush TLB when CR3 is reset
-    -cache_disabled = cache enabled/disabled flag
-    -write_through = write-through flag
 *   Return Value: none
 *   Function: does the actual mapping of the large page from mmap_large()
 */
 void map_large_page(uint32_t* page_dir, void* phys, void* virt,
-        uint8_t access, uint8_t global, uint8_t cache_disabled, uint8_t write_through) {
+        uint8_t access, uint8_t global) {
     pd_large_entry_t kernel_pd_entry;
     memset(&kernel_pd_entry, 0x00, sizeof(pd_large_entry_t));
 
     kernel_pd_entry.present = 1;        // Present
     kernel_pd_entry.read_write = 1;     // Read/Write
     kernel_pd_entry.user_supervisor = access;
-    kernel_pd_entry.write_through = write_through;  // Write-Through caching enabled
-    kernel_pd_entry.cache_disabled = cache_disabled;
     kernel_pd_entry.size = 1;           // 4MB pages
+
+    // Caching as mem_type_of says for the memory
+    mem_attr_t attr = mem_type_attr(mem_type_of(phys));
+    kernel_pd_entry.pat = attr.pat;
+    kernel_pd_entry.cache_disabled = attr.cache_disabled;
+    kernel_pd_entry.write_through = attr.write_through;
+
     kernel_pd_entry.global = global;    // If global, don't flush TLB if CR3 is reset
     kernel_pd_entry.addr = ((uint32_t) phys) >> 22;
 
@@ -141,32 +293,255 @@ void register_page_table(uint32_t* page_dir, uint32_t index,
 }
 
 /*
-* void init_task_paging(uint32_t pid)
+* uint32_t* get_page_table(uint32_t* page_dir, void* virt, uint8_t access, uint8_t alloc)
+*   Inputs:
+    -page_dir = page directory
+    -virt = virtual address the page table has to cover
+    -access = access level the page table is needed for
+    -alloc = whether to allocate the page table if it doesn't exist yet
+*   Return Value: the page table, or NULL if there is none (or a large page
+*                 covers virt, or memory ran out)
+*   Function: finds the page table covering virt. A page table is registered
+*             for users as soon as it holds a user page; the page table
+*             entries themselves still decide which pages users can reach
+*/
+uint32_t* get_page_table(uint32_t* page_dir, void* virt, uint8_t access, uint8_t alloc) {
+    uint32_t index = ((uint32_t) virt) >> 22;
+
+    pd_entry_t pd_entry;
+    pd_entry.val = page_dir[index];
+
+    if(pd_entry.present) {
+        if(pd_entry.size) {
+            return NULL; // 4MB page, no page table to use
+        }
+
+        if(access == ACCESS_ALL && !pd_entry.user_supervisor) {
+            pd_entry.user_supervisor = ACCESS_ALL;
+            page_dir[index] = pd_entry.val;
+        }
+
+        // Page tables are identity mapped for the kernel
+        return (uint32_t*) (pd_entry.addr << 12);
+    }
+
+    if(!alloc) {
+        return NULL;
+    }
+
+    uint32_t* page_table = frame_alloc(1, 1);
+    if(page_table == NULL) {
+        log(ERROR, "No memory for a page table", "get_page_table");
+        return NULL;
+    }
+
+    memset(page_table, 0x00, FOUR_KB);
+    register_page_table(page_dir, index, page_table, access);
+    return page_table;
+}
+
+/*
+* uint32_t page_table_empty(uint32_t* page_table)
+*   Inputs:
+    -page_table = page table
+*   Return Value: 1 if nothing is mapped in the page table, 0 otherwise
+*   Function: checks whether a page table can be freed
+*/
+static uint32_t page_table_empty(uint32_t* page_table) {
+    int i;
+    for(i = 0; i < MAX_ENTRIES; i++) {
+        if(page_table[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+* void map_terminal_screens(uint32_t* page_table)
+*   Inputs:
+    -page_table = page table for [0, 4MB)
+*   Return Value: none
+*   Function: identity maps the screens of the terminals after the first,
+*             which live in VGA memory past VIDEO, for the kernel, so output
+*             for any terminal can be written no matter which task is running
+*/
+void map_terminal_screens(uint32_t* page_table) {
+    int i;
+    for(i = 1; i < NUM_TERMINALS; i++) {
+        void* screen = (void*) TERMINAL_SCREEN(i);
+        map_page(page_table, screen, screen, ACCESS_SUPER);
+    }
+}
+
+/*
+* void map_frame_memory(uint32_t* page_dir)
+*   Inputs:
+    -page_dir = page directory
+*   Return Value: none
+*   Function: identity maps the memory the frame allocator hands out for the
+*             kernel, so kernel stacks, paging structures and program frames
+*             can be reached from any task. The mapping is global, as it is
+*             the same in every page directory
+*/
+void map_frame_memory(uint32_t* page_dir) {
+    uint32_t addr;
+    for(addr = FRAMES_START; addr < FRAMES_END; addr += FOUR_MB) {
+        map_large_page(page_dir, ((void*) addr), ((void*) addr),
+                ACCESS_SUPER, GLOBAL);
+    }
+}
+
+/*
+* int32_t init_task_paging(uint32_t pid)
+*   Inputs:
+    -pid = Process ID
+*   Return Value: -1 if out of memory, 0 on success
+*   Function: allocates paging for task with pid as a copy of the template
+*             from init_paging, with an empty page table over its program
+*             window. Pages of the window are mapped as the program touches
+*             them. Page tables beyond those are allocated when something
+*             is mapped in their range
+*/
+int32_t init_task_paging(uint32_t pid) {
+    page_dirs[pid] = frame_alloc(1, 1);
+    if(page_dirs[pid] == NULL) {
+        log(ERROR, "No memory for a page directory", "init_task_paging");
+        return -1;
+    }
+    memcpy(page_dirs[pid], task_page_dir_template, FOUR_KB);
+
+    if(get_page_table(page_dirs[pid], ((void*) USER_PAGE_VIRT), ACCESS_ALL, 1) == NULL) {
+        log(ERROR, "No memory for the program window", "init_task_paging");
+        free_task_paging(pid);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+* void free_task_paging(uint32_t pid)
 *   Inputs:
     -pid = Process ID
 *   Return Value: none
-*   Function: initializes paging for task with pid
+*   Function: gives the page directory, every page table but the shared
+*             first one and the frames the task owns back to the frame
+*             allocator. The task must not be running on them
 */
-void init_task_paging(uint32_t pid) {
-    // Register first user page table [0GB, 4MB)
-    register_page_table(page_dirs[pid], 0, page_tables[pid][0], ACCESS_SUPER);
+void free_task_paging(uint32_t pid) {
+    uint32_t* page_dir = page_dirs[pid];
+    if(pid == KERNEL_PID || page_dir == NULL) {
+        return;
+    }
 
-    // Map page for video memory in first user page table
-    map_page(page_tables[pid][0], ((void*) VIDEO), ((void*) VIDEO), ACCESS_SUPER);
+    int i, j;
+    for(i = 0; i < MAX_ENTRIES; i++) {
+        pd_entry_t pd_entry;
+        pd_entry.val = page_dir[i];
 
-    // Register second user page table [1GB, 1GB + 4MB)
-    register_page_table(page_dirs[pid], 256, page_tables[pid][1], ACCESS_ALL);
+        // Large pages are shared with the kernel, as is the first page table
+        if(!pd_entry.present || pd_entry.size ||
+                (uint32_t*) (pd_entry.addr << 12) == task_page_table) {
+            continue;
+        }
 
-    // Map large page for kernel code
-    map_large_page(page_dirs[pid], ((void*) FOUR_MB), ((void*) FOUR_MB),
-            ACCESS_SUPER, NOT_GLOBAL, CACHE_DISABLED, WRITE_THROUGH_ENABLED);
+        // Other mappings (video memory, the filesystem image) belong to someone else
+        uint32_t* page_table = (uint32_t*) (pd_entry.addr << 12);
+        for(j = 0; j < MAX_ENTRIES; j++) {
+            pt_entry_t pt_entry;
+            pt_entry.val = page_table[j];
+            if(pt_entry.present && (pt_entry.available & PT_OWNED_FRAME)) {
+                frame_free((void*) (pt_entry.addr << 12), 1);
+            }
+        }
+
+        frame_free(page_table, 1);
+    }
+
+    frame_free(page_dir, 1);
+    page_dirs[pid] = NULL;
+}
+
+/*
+* void* map_task_frame(uint32_t pid, void* virt)
+*   Inputs:
+    -pid = Process ID
+    -virt = virtual address inside the program window
+*   Return Value: the kernel's address of the new frame, or NULL if out of memory
+*   Function: backs a page of the program window of task pid with a frame of
+*             its own, writable by the program and freed with its paging.
+*             The frame isn't cleared. The page must not have been mapped,
+*             so there is no TLB entry to flush
+*/
+void* map_task_frame(uint32_t pid, void* virt) {
+    uint32_t* page_table = get_page_table(page_dirs[pid], virt, ACCESS_ALL, 0);
+    if(page_table == NULL) {
+        log(ERROR, "Address isn't in the program window", "map_task_frame");
+        return NULL;
+    }
+
+    void* frame = frame_alloc(1, 1);
+    if(frame == NULL) {
+        log(ERROR, "No memory for a program page", "map_task_frame");
+        return NULL;
+    }
+
+    map_page(page_table, frame, virt, ACCESS_ALL);
+
+    pt_entry_t pt_entry;
+    pt_entry.val = page_table[(((uint32_t) virt) >> 12) & 0x3FF];
+    pt_entry.available = PT_OWNED_FRAME;
+    page_table[(((uint32_t) virt) >> 12) & 0x3FF] = pt_entry.val;
+
+    return frame;
+}
+
+/*
+* void unmap_task_frame(uint32_t pid, void* virt)
+*   Inputs:
+    -pid = Process ID of the running task
+    -virt = virtual address inside the program window
+*   Return Value: none
+*   Function: unmaps a page of the program window of the running task and
+*             frees its frame, if it was mapped with map_task_frame
+*/
+void unmap_task_frame(uint32_t pid, void* virt) {
+    uint32_t* page_table = get_page_table(page_dirs[pid], virt, ACCESS_ALL, 0);
+    if(page_table == NULL) {
+        return;
+    }
 
-    // Map large page for loading user-level program
-    map_large_page(page_dirs[pid], ((void*) (FOUR_MB + (pid * FOUR_MB))),
-            ((void*) (128 * MB)), ACCESS_ALL, NOT_GLOBAL, CACHE_ENABLED, WRITE_THROUGH_ENABLED);
+    pt_entry_t pt_entry;
+    pt_entry.val = page_table[(((uint32_t) virt) >> 12) & 0x3FF];
+    if(!pt_entry.present || !(pt_entry.available & PT_OWNED_FRAME)) {
+        return;
+    }
 
-    // Change CR3 register to new paging directory
-    set_page_dir(pid);
+    unmap_page(page_table, virt);
+    flush_tlb_page(virt);
+    frame_free((void*) (pt_entry.addr << 12), 1);
+}
+
+/*
+* void map_task_image_page(uint32_t pid, void* phys, void* virt)
+*   Inputs:
+    -pid = Process ID
+    -phys = physical address
+    -virt = virtual address inside the program window
+*   Return Value: none
+*   Function: maps a read-only user page into the program window of task pid.
+*             The page must not have been mapped, so there is no TLB entry
+*             to flush
+*/
+void map_task_image_page(uint32_t pid, void* phys, void* virt) {
+    uint32_t* page_table = get_page_table(page_dirs[pid], virt, ACCESS_ALL, 0);
+    if(page_table == NULL) {
+        log(ERROR, "Address isn't in the program window", "map_task_image_page");
+        return;
+    }
+
+    map_page_readonly(page_table, phys, virt, ACCESS_ALL);
 }
 
 /*
@@ -182,56 +557,94 @@ void set_page_dir(uint32_t pid) {
 }
 
 /*
-* void restore_parent_paging(uint32_t pid, uint32_t parent_pid)
+* void flush_tlb()
+*   Inputs: none
+*   Return Value: none
+*   Function: flushes every TLB entry that isn't global by reloading CR3
+*/
+void flush_tlb() {
+    asm volatile("movl %%cr3, %%eax;"
+                 "movl %%eax, %%cr3;"
+                 : : : "eax", "memory");
+}
+
+/*
+* void flush_tlb_all()
+*   Inputs: none
+*   Return Value: none
+*   Function: flushes every TLB entry, global ones included, by turning
+*             global pages off and back on in CR4
+*/
+void flush_tlb_all() {
+    asm volatile("movl %%cr4, %%eax;"
+                 "andl %0, %%eax;"
+                 "movl %%eax, %%cr4;"
+                 "orl  %1, %%eax;"
+                 "movl %%eax, %%cr4;"
+                 : : "i"(~CR4_PGE), "i"(CR4_PGE) : "eax", "memory");
+}
+
+/*
+* void flush_tlb_page(void* virt)
 *   Inputs:
-    -pid = Process ID
-    -parent_pid = parent process ID
+    -virt = virtual address whose mapping changed
 *   Return Value: none
-*   Function: Wrapper function for set_page_dir
+*   Function: flushes the TLB entry of a single page with invlpg. Inside a
+*             batch, the page is only recorded, and flushed at the end
 */
-void restore_parent_paging(uint32_t pid, uint32_t parent_pid) {
-    set_page_dir(parent_pid);
+void flush_tlb_page(void* virt) {
+    if(batch_depth == 0) {
+        invlpg(virt);
+        return;
+    }
+
+    // Past PAGING_BATCH_MAX pages, the batch ends with a full flush instead
+    if(batch_count < PAGING_BATCH_MAX) {
+        batch_pages[batch_count] = virt;
+    }
+    batch_count++;
 }
 
-/**
- * remap_video_memory(uint32_t old_pid, uint32_t new_pid)
- * Description: remap the video memory
- * Inputs: old_pid - old terminal, new_pid - new terminal
- */
-void remap_video_memory(uint32_t old_pid, uint32_t new_pid) {
-    cli(); // Begin critical section
+/*
+* void paging_batch_begin()
+*   Inputs: none
+*   Return Value: none
+*   Function: starts a batch of mapping changes. Until the matching
+*             paging_batch_end, the changes aren't visible to the current
+*             task's TLB. Batches can be nested. Interrupts must be disabled
+*/
+void paging_batch_begin() {
+    batch_depth++;
+}
 
-    pcb_t* old_pcb = get_pcb_ptr_pid(old_pid);
-    pcb_t* new_pcb = get_pcb_ptr_pid(new_pid);
+/*
+* void paging_batch_end()
+*   Inputs: none
+*   Return Value: none
+*   Function: ends a batch of mapping changes. When the outermost batch ends,
+*             the TLB is flushed page by page, or all at once if more pages
+*             changed than that would be worth. Pages in the batch may be
+*             global, so a CR3 reload isn't enough for that
+*/
+void paging_batch_end() {
+    if(batch_depth == 0) {
+        log(WARN, "No batch to end", "paging_batch_end");
+        return;
+    }
 
-    if(new_pcb->terminal_index == current_terminal) {
-        // Map VIDEO to VIDEO for new task
-        //log(DEBUG, "new: Mapping VIDEO to VIDEO", "remap_video_memory");
-        map_page(page_tables[new_pid][0], ((void*) VIDEO), ((void*) VIDEO), ACCESS_SUPER);
-    } else {
-        // Map VIDEO to backing store for new task
-        //log(DEBUG, "new: Mapping VIDEO to new_backing", "remap_video_memory");
-        uint32_t new_terminal = get_pcb_ptr_pid(new_pid)->terminal_index;
-        void* new_backing = (void*) (VIDEO + (FOUR_KB * (new_terminal + 1)));
-        map_page(page_tables[new_pid][0], new_backing, ((void*) VIDEO), ACCESS_SUPER);
+    if(--batch_depth > 0) {
+        return;
     }
 
-    if(old_pid > KERNEL_PID) {
-        if(old_pcb->terminal_index == current_terminal) {
-            // Map VIDEO to VIDEO for old task
-            //log(DEBUG, "old: Mapping VIDEO to VIDEO", "remap_video_memory");
-            map_page(page_tables[old_pid][0], ((void*) VIDEO), ((void*) VIDEO), ACCESS_SUPER);
-        } else {
-            // Remap VIDEO to backing store for old task
-            //log(DEBUG, "old: Mapping VIDEO to old_backing", "remap_video_memory");
-            uint32_t old_terminal = get_pcb_ptr_pid(old_pid)->terminal_index;
-            void* old_backing = (void*) (VIDEO + (FOUR_KB * (old_terminal + 1)));
-            map_page(page_tables[old_pid][0], old_backing, ((void*) VIDEO), ACCESS_SUPER);
+    if(batch_count > PAGING_BATCH_MAX) {
+        flush_tlb_all();
+    } else {
+        uint32_t i;
+        for(i = 0; i < batch_count; i++) {
+            invlpg(batch_pages[i]);
         }
     }
-
-    // Flush TLB
-    set_page_dir(new_pid);
+    batch_count = 0;
 }
 
 /*
@@ -240,38 +653,30 @@ void remap_video_memory(uint32_t old_pid, uint32_t new_pid) {
     -phys = physical address
     -virt = virtual address
     -access = access level of page
-*   Return Value: none
+*   Return Value: -1 on failure, 0 on success
 *   Function: wrapper function for mapping page
 */
-void mmap(void* phys, void* virt, uint8_t access) {
+int32_t mmap(void* phys, void* virt, uint8_t access) {
     pcb_t* pcb = get_pcb_ptr();
-    mmap_pid((pcb == NULL) ? KERNEL_PID : pcb->pid, phys, virt, access);
+    return mmap_pid((pcb == NULL) ? KERNEL_PID : pcb->pid, phys, virt, access);
 }
 
 /**
  * mmap_pid(uint32_t pid, void* phys, void* virt, uint8_t access)
- * Description: Maps the pid to memory
+ * Description: Maps a page for the pid, allocating its page table if needed
  * Inputs: pid - the pid, virt - virtual address, access - sets access
- * Outputs: none
+ * Outputs: -1 on failure, 0 on success
  */
-void mmap_pid(uint32_t pid, void* phys, void* virt, uint8_t access) {
-    uint32_t raw_virt = (uint32_t) virt;
-
-    uint32_t page_table_idx;
-    if(raw_virt < FOUR_MB) {
-        page_table_idx = 0;
-    } else if(raw_virt >= GB && raw_virt < (GB + FOUR_MB)) {
-        page_table_idx = 1;
-    } else {
-        log(ERROR, "Need to allocate more page tables!", "mmap");
-        return;
+int32_t mmap_pid(uint32_t pid, void* phys, void* virt, uint8_t access) {
+    uint32_t* page_table = get_page_table(page_dirs[pid], virt, access, 1);
+    if(page_table == NULL) {
+        log(ERROR, "Can't get a page table for the address", "mmap");
+        return -1;
     }
 
-    map_page(page_tables[pid][page_table_idx], phys, virt, access);
-
-    // Flush TLB
-    asm volatile("movl %%cr3, %%eax;"::);
-    asm volatile("movl %%eax, %%cr3;"::);
+    map_page(page_table, phys, virt, access);
+    flush_tlb_page(virt);
+    return 0;
 }
 
 /**
@@ -287,46 +692,119 @@ void munmap(void* virt) {
 
 /**
  * munmap_pid(uint32_t pid, void* virt)
+ * Description: Unmaps a page of the pid, freeing its page table once it is
+ *              empty. The page tables from init_paging are never freed
  * Inputs: pid - pid, virt - virtual address
  * Outputs: none
  */
 void munmap_pid(uint32_t pid, void* virt) {
-    uint32_t raw_virt = (uint32_t) virt;
-
-    uint32_t page_table_idx;
-    if(raw_virt < FOUR_MB) {
-        page_table_idx = 0;
-    } else if(raw_virt >= GB && raw_virt < (GB + FOUR_MB)) {
-        page_table_idx = 1;
-    } else {
-        log(ERROR, "Need to allocate more page tables!", "mmap");
+    uint32_t* page_table = get_page_table(page_dirs[pid], virt, ACCESS_SUPER, 0);
+    if(page_table == NULL) {
         return;
     }
 
-    unmap_page(page_tables[pid][page_table_idx], virt);
+    unmap_page(page_table, virt);
+
+    if(page_table != kernel_page_table && page_table != task_page_table &&
+            page_table_empty(page_table)) {
+        page_dirs[pid][((uint32_t) virt) >> 22] = 0;
+        frame_free(page_table, 1);
+    }
 
-    // Flush TLB
-    asm volatile("movl %%cr3, %%eax;"::);
-    asm volatile("movl %%eax, %%cr3;"::);
+    // Also drops any cached page directory entry for the page table
+    flush_tlb_page(virt);
 }
 
 /*
-* void mmap_large(void* phys, void* virt, uint8_t access, uint8_t write_through)
+* void mmap_large(void* phys, void* virt, uint8_t access)
 *   Inputs:
     -phys = physical address
     -virt = virtual address
     -access = access level of page
-    -write_through = write-through flag
 *   Return Value: none
 *   Function: wrapper function for mapping large page
 */
 
-void mmap_large(void* phys, void* virt, uint8_t access, uint8_t write_through) {
+void mmap_large(void* phys, void* virt, uint8_t access) {
     pcb_t* pcb = get_pcb_ptr();
     map_large_page(page_dirs[(pcb == NULL) ? KERNEL_PID : pcb->pid],
-            phys, virt, access, GLOBAL, CACHE_DISABLED, write_through);
+            phys, virt, access, NOT_GLOBAL);
+    flush_tlb_page(virt);
+}
+
+/*
+* void remap_kernel_page(uint32_t mem_type)
+*   Inputs:
+    -mem_type = memory type to give the kernel's 4MB page
+*   Return Value: none
+*   Function: overrides the memory type of the kernel page in the kernel's
+*             own page directory, for benchmarks comparing memory types. Only
+*             affects the boot thread. Pass mem_type_of(FOUR_MB) to restore it
+*/
+void remap_kernel_page(uint32_t mem_type) {
+    uint32_t index = FOUR_MB >> 22;
+
+    pd_large_entry_t pd_entry;
+    pd_entry.val = kernel_page_dir[index];
+
+    mem_attr_t attr = mem_type_attr(mem_type);
+    pd_entry.pat = attr.pat;
+    pd_entry.cache_disabled = attr.cache_disabled;
+    pd_entry.write_through = attr.write_through;
+    kernel_page_dir[index] = pd_entry.val;
+
+    // Write back anything cached under the old type, then drop the old entry.
+    // The page is global, so only invlpg gets rid of it
+    asm volatile("wbinvd" : : : "memory");
+    invlpg((void*) FOUR_MB);
+}
+
+/*
+* void paging_bench()
+*   Inputs: none
+*   Return Value: none
+*   Function: prints the average rdtsc cycle counts of remapping the vidmap
+*             page, flushed with invlpg and with a CR3 reload as it used to
+*             be, and of a round trip between two terminal screens
+*/
+void paging_bench() {
+    uint64_t start, end;
+    uint32_t i;
+
+    cli();
+
+    // Make sure the page table for the vidmap page exists before timing
+    mmap(((void*) VIDEO), ((void*) GB), ACCESS_ALL);
+
+    start = rdtsc();
+    for(i = 0; i < PAGING_BENCH_ITERS; i++) {
+        mmap(get_terminal_video_mem(i % NUM_TERMINALS), ((void*) GB), ACCESS_ALL);
+        *((volatile uint8_t*) GB);
+    }
+    end = rdtsc();
+    printf("vidmap remap (invlpg): %u cycles\n", ((uint32_t) (end - start)) / PAGING_BENCH_ITERS);
+
+    start = rdtsc();
+    for(i = 0; i < PAGING_BENCH_ITERS; i++) {
+        mmap(get_terminal_video_mem(i % NUM_TERMINALS), ((void*) GB), ACCESS_ALL);
+        flush_tlb();
+        *((volatile uint8_t*) GB);
+    }
+    end = rdtsc();
+    printf("vidmap remap (CR3 reload): %u cycles\n", ((uint32_t) (end - start)) / PAGING_BENCH_ITERS);
+
+    munmap((void*) GB);
+
+    uint32_t terminal = current_terminal;
+    uint32_t other = (terminal + 1) % NUM_TERMINALS;
+
+    start = rdtsc();
+    for(i = 0; i < PAGING_BENCH_ITERS; i++) {
+        switch_active_terminal_screen(other);
+        switch_active_terminal_screen(terminal);
+    }
+    end = rdtsc();
+    printf("terminal switch round trip: %u cycles\n", ((uint32_t) (end - start)) / PAGING_BENCH_ITERS);
 
-    // Flush TLB
-    asm volatile("movl %%cr3, %%eax;"::);
-    asm volatile("movl %%eax, %%cr3;"::);
+    sti();
 }
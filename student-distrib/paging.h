@@ -8,24 +8,51 @@
 #include "lib.h"
 #include "tasks.h"
 #include "devices/terminal.h"
+#include "frames.h"
 
 #define MAX_ENTRIES 1024
 
-/*
- * We only need to allocate two page tables for each task. One will be for
- * memory addresses in the range [0GB,4MB) and the other for memory addresses
- * in the range [1GB, 1GB + 4MB)
- */
-#define NUM_PAGE_TABLES 2
+// Virtual address of the 4MB window user programs are loaded into
+#define USER_PAGE_VIRT (128 * MB)
+
+// Page table entry available bit marking a frame the task owns and frees with its paging
+#define PT_OWNED_FRAME 0x1
 
 #define ACCESS_ALL 1
 #define ACCESS_SUPER 0
 #define GLOBAL 1
 #define NOT_GLOBAL 0
-#define CACHE_ENABLED 0
-#define CACHE_DISABLED 1
-#define WRITE_THROUGH_ENABLED 1
-#define WRITE_THROUGH_DISABLED 0
+
+/*
+ * Memory types a mapping can get. map_page and map_large_page pick one from
+ * the physical address with mem_type_of: RAM is write-back cached, video
+ * memory is write-combining and other memory-mapped I/O is uncached
+ */
+#define MEM_WRITE_BACK      0
+#define MEM_UNCACHED        1
+#define MEM_WRITE_COMBINING 2
+
+// Physical ranges that aren't normal RAM
+#define VGA_MEM_START 0xA0000
+#define VGA_MEM_END   0xC0000
+#define ISA_HOLE_END  0x100000
+
+// CPUID feature flag for the page attribute table
+#define CPUID_PAT (1 << 16)
+
+// Page attribute table MSR, and the entry (PAT=1, PCD=0, PWT=0) reprogrammed to write-combining
+#define MSR_PAT           0x277
+#define PAT_WC_ENTRY      4
+#define PAT_TYPE_WC       0x01
+
+// Pages a batch invalidates one at a time before falling back to a full TLB flush
+#define PAGING_BATCH_MAX 16
+
+// CR4 bit that enables global pages
+#define CR4_PGE 0x00000080
+
+// Iterations timed by paging_bench
+#define PAGING_BENCH_ITERS 1000
 
 // Struct for 4KB page directory entries
 typedef union pd_entry_t {
@@ -59,7 +86,8 @@ typedef union pd_large_entry_t {
         uint8_t size : 1;
         uint8_t global : 1;
         uint8_t available : 3;
-        uint16_t reserved0 : 10;
+        uint8_t pat : 1;
+        uint16_t reserved0 : 9;
         uint32_t addr : 10;
     } __attribute__((packed));
 } pd_large_entry_t;
@@ -75,7 +103,7 @@ typedef union pt_entry_t {
         uint8_t cache_disabled : 1;
         uint8_t accessed : 1;
         uint8_t dirty : 1;
-        uint8_t reserved0 : 1;
+        uint8_t pat : 1;
         uint8_t global : 1;
         uint8_t available : 3;
         uint32_t addr : 20;
@@ -88,34 +116,76 @@ void init_paging();
 // Map a small (4KB) page
 void map_page(uint32_t* page_table, void* phys, void* virt, uint8_t access);
 
+// Map a small (4KB) page without write access
+void map_page_readonly(uint32_t* page_table, void* phys, void* virt, uint8_t access);
+
 // Unmap a small (4KB) page
 void unmap_page(uint32_t* page_table, void* virt);
 
 // Map a large (4MB) page
 void map_large_page(uint32_t* page_dir, void* phys, void* virt,
-        uint8_t access, uint8_t global, uint8_t cache_disabled, uint8_t write_through);
+        uint8_t access, uint8_t global);
+
+// Get the memory type physical memory is mapped with
+uint32_t mem_type_of(void* phys);
+
+// Remap the kernel's own 4MB page with another memory type
+void remap_kernel_page(uint32_t mem_type);
 
 // Register a page directory entry for a 4KB page table
 void register_page_table(uint32_t* page_dir, uint32_t index,
         uint32_t* page_table, uint8_t access);
 
+// Find (or allocate) the page table covering an address
+uint32_t* get_page_table(uint32_t* page_dir, void* virt, uint8_t access, uint8_t alloc);
+
+// identity map the screens of the other terminals
+void map_terminal_screens(uint32_t* page_table);
+
+// identity map the frame allocator's memory
+void map_frame_memory(uint32_t* page_dir);
+
 // initialize paging
-void init_task_paging(uint32_t pid);
+int32_t init_task_paging(uint32_t pid);
+
+// free the paging structures of a task
+void free_task_paging(uint32_t pid);
+
+// back a page of a task's program window with a frame of its own
+void* map_task_frame(uint32_t pid, void* virt);
+
+// unmap a page of the running task's program window and free its frame
+void unmap_task_frame(uint32_t pid, void* virt);
+
+// map a read-only page into a task's program window
+void map_task_image_page(uint32_t pid, void* phys, void* virt);
 
 // set the page directory
 void set_page_dir(uint32_t pid);
 
-// restore paging
-void restore_parent_paging(uint32_t pid, uint32_t parent_pid);
+// flush the whole TLB, except for global pages
+void flush_tlb();
+
+// flush the whole TLB, global pages included
+void flush_tlb_all();
+
+// flush the TLB entry of one page, or queue it if a batch is open
+void flush_tlb_page(void* virt);
+
+// start a batch of mapping changes
+void paging_batch_begin();
+
+// end a batch of mapping changes, flushing the TLB once for all of them
+void paging_batch_end();
 
-// remap the video memory
-void remap_video_memory(uint32_t old_pid, uint32_t new_pid);
+// time vidmap remaps and terminal switches
+void paging_bench();
 
 // wrapper for mapping page
-void mmap(void* phys, void* virt, uint8_t access);
+int32_t mmap(void* phys, void* virt, uint8_t access);
 
 // map pid
-void mmap_pid(uint32_t pid, void* phys, void* virt, uint8_t access);
+int32_t mmap_pid(uint32_t pid, void* phys, void* virt, uint8_t access);
 
 // map pbc to pid
 void munmap(void* virt);
@@ -124,6 +194,6 @@ void munmap(void* virt);
 void munmap_pid(uint32_t pid, void* virt);
 
 // wrapper function for mapping a large page
-void mmap_large(void* phys, void* virt, uint8_t access, uint8_t write_through);
+void mmap_large(void* phys, void* virt, uint8_t access);
 
 #endif /* PAGING_H */
@@ -4,116 +4,286 @@
  * vim:ts=4 expandtab
  */
 #include "tasks.h"
+#include "interrupts/syscalls.h"
+#include "kmalloc.h"
 
 // File descriptor table used by the kernel (will probably be moved later)
 file_desc_t kernel_file_array[FILE_ARRAY_SIZE];
+fd_table_t kernel_fds;
 
-// If PID in use, pid_use_array[pid] = 1, 0 otherwise
-uint32_t pid_use_array[MAX_TASKS + 1] = {0};
+// If PID in use, pcb_table[pid] points to its PCB, NULL otherwise
+pcb_t* pcb_table[MAX_TASKS + 1] = {NULL};
 
-// Declared in syscalls.c
-extern void* halt_ret_lbl asm("halt_ret_lbl");
+// Bottom of the kernel stack of each PID in use
+static uint8_t* kernel_stacks[MAX_TASKS + 1];
 
-// Declared in terminal.c
-extern volatile uint32_t active_pids[NUM_TERMINALS];
+// PCBs of every task. Set up by init_kernel_file_array
+static kmem_cache_t* pcb_cache;
+
+// Task that halted but is still to be freed, KERNEL_PID if there is none
+static uint32_t dead_pid = KERNEL_PID;
+
+/*
+ * PCB of the running task, or NULL while the boot thread (the pre-shell
+ * kernel, and later the idle loop) runs. Only task_switch changes it, right
+ * before switching stacks
+ */
+pcb_t* current_pcb = NULL;
+
+// Registers of the boot thread, which runs whenever no task is runnable
+static task_context_t idle_context;
+
+// Runnable tasks waiting for the CPU, oldest first. The running task isn't on it
+static pcb_t* run_queue_head = NULL;
+static pcb_t* run_queue_tail = NULL;
+
+// What every PCB starts out as, with stdin and stdout open. Built by init_kernel_file_array
+static pcb_t pcb_template;
+
+// PIT ticks each task runs for before it is preempted
+static uint32_t timeslice_ticks = TASK_TIMESLICE_TICKS;
 
 /*
 * void init_kernel_file_array()
 *   Inputs:
 *   Return Value: none
-*   Function: begins filesystem processing by the kernel
+*   Function: begins filesystem processing by the kernel, and sets up the
+*             cache PCBs come from and the template they are copied from
 */
 void init_kernel_file_array() {
-    // Initialize kernel stdin file desctriptor
-    file_desc_t stdin_kernel;
-    memset(&stdin_kernel, 0x00, sizeof(file_desc_t));
-    stdin_kernel.read = terminal_read;
-    stdin_kernel.write = terminal_write;
-    stdin_kernel.open = terminal_open;
-    stdin_kernel.close = terminal_close;
-    stdin_kernel.inode_num = 0;
-    stdin_kernel.file_pos = 0;
-    stdin_kernel.flags = 1; // In-use
-    kernel_file_array[STDIN_FD] = stdin_kernel;
-
-    // Initialize kernel stdout file desctriptor
-    file_desc_t stdout_kernel;
-    memset(&stdout_kernel, 0x00, sizeof(file_desc_t));
-    stdout_kernel.read = terminal_read;
-    stdout_kernel.write = terminal_write;
-    stdout_kernel.open = terminal_open;
-    stdout_kernel.close = terminal_close;
-    stdout_kernel.inode_num = 0;
-    stdout_kernel.file_pos = 0;
-    stdout_kernel.flags = 1; // In-use
-    kernel_file_array[STDOUT_FD] = stdout_kernel;
+    fd_table_init(&kernel_fds, kernel_file_array);
+
+    pcb_cache = kmem_cache_create("pcb", sizeof(pcb_t));
+
+    memset(&pcb_template, 0x00, sizeof(pcb_t));
+    fd_table_init(&(pcb_template.fds), pcb_template.file_slots);
 }
 
 /*
-* pcb_t* init_pcb(uint32_t pid)
+* void fd_table_init(fd_table_t* table, file_desc_t* slots)
 *   Inputs:
-*   -pid = process id
-*   Return Value: pointer to PCB data sctructure
-*   Function: initializes PCB for the given process ID
+*   -table = file descriptor table to set up
+*   -slots = FILE_ARRAY_SIZE entries the table starts out in
+*   Return Value: None
+*   Function: empties a file descriptor table, then opens stdin and stdout
+*             on the terminal
 */
-pcb_t* init_pcb(uint32_t pid) {
-    pcb_t pcb;
-    memset(&pcb, 0x00, sizeof(pcb_t));
-
-    pcb.pid = pid;
+void fd_table_init(fd_table_t* table, file_desc_t* slots) {
+    memset(table, 0x00, sizeof(fd_table_t));
+    memset(slots, 0x00, FILE_ARRAY_SIZE * sizeof(file_desc_t));
+    table->files = slots;
+    table->size = FILE_ARRAY_SIZE;
 
     // Initialize stdin file desctriptor
-    file_desc_t stdin;
-    memset(&stdin, 0x00, sizeof(file_desc_t));
-    stdin.read = terminal_read;
-    stdin.write = terminal_write;
-    stdin.open = terminal_open;
-    stdin.close = terminal_close;
-    stdin.inode_num = 0;
-    stdin.file_pos = 0;
-    stdin.flags = 1; // In-use
-    pcb.file_array[STDIN_FD] = stdin;
-
-    // Initialize kernel stdout file desctriptor
-    file_desc_t stdout;
-    memset(&stdout, 0x00, sizeof(file_desc_t));
-    stdout.read = terminal_read;
-    stdout.write = terminal_write;
-    stdout.open = terminal_open;
-    stdout.close = terminal_close;
-    stdout.inode_num = 0;
-    stdout.file_pos = 0;
-    stdout.flags = 1; // In-use
-    pcb.file_array[STDOUT_FD] = stdout;
-
-    // Place into memory
-    void* pcb_mem_location = (void*) ((8 * MB) - ((pid + 1) * (8 * KB)));
-    memcpy(pcb_mem_location, &pcb, sizeof(pcb_t));
-
-    return (pcb_t*) pcb_mem_location;
+    slots[STDIN_FD].ops = &terminal_ops;
+    slots[STDIN_FD].flags = FD_IN_USE;
+
+    // Initialize stdout file desctriptor
+    slots[STDOUT_FD].ops = &terminal_ops;
+    slots[STDOUT_FD].flags = FD_IN_USE;
+
+    table->used[0] = (1 << STDIN_FD) | (1 << STDOUT_FD);
+}
+
+/*
+* uint32_t fd_table_frames(uint32_t size)
+*   Inputs:
+*   -size = number of entries
+*   Return Value: number of frames, 0 if the table fits in a kmalloc block
+*   Function: gets how many frames a grown table of size entries takes up
+*/
+static uint32_t fd_table_frames(uint32_t size) {
+    if(size * sizeof(file_desc_t) <= KMALLOC_MAX) {
+        return 0;
+    }
+    return (size * sizeof(file_desc_t) + FRAME_SIZE - 1) / FRAME_SIZE;
+}
+
+/*
+* int32_t fd_table_grow(fd_table_t* table)
+*   Inputs:
+*   -table = full file descriptor table
+*   Return Value: -1 on failure, 0 on success
+*   Function: moves a table into memory with room for at least twice as
+*             many entries, up to FILE_ARRAY_MAX. Small tables come from
+*             kmalloc, larger ones from the frame allocator, filling their
+*             frames, so a 4KB one holds about 200 entries
+*/
+static int32_t fd_table_grow(fd_table_t* table) {
+    if(table->size >= FILE_ARRAY_MAX) {
+        log(WARN, "No remaining file descriptors", "fd_table_grow");
+        return -1;
+    }
+
+    uint32_t frames = fd_table_frames(2 * table->size);
+    uint32_t size = (frames == 0) ? 2 * table->size : frames * FRAME_SIZE / sizeof(file_desc_t);
+    if(size > FILE_ARRAY_MAX) {
+        size = FILE_ARRAY_MAX;
+    }
+
+    file_desc_t* files = (frames == 0) ? kmalloc(size * sizeof(file_desc_t)) : frame_alloc(frames, 1);
+    if(files == NULL) {
+        log(ERROR, "No memory for a larger file descriptor table", "fd_table_grow");
+        return -1;
+    }
+
+    memcpy(files, table->files, table->size * sizeof(file_desc_t));
+    memset(files + table->size, 0x00, (size - table->size) * sizeof(file_desc_t));
+
+    fd_table_free(table);
+    table->files = files;
+    table->size = size;
+    return 0;
+}
+
+/*
+* int32_t fd_alloc(fd_table_t* table)
+*   Inputs:
+*   -table = file descriptor table of the task opening a file
+*   Return Value: the new file descriptor, or -1 if there are none left
+*   Function: finds the lowest free file descriptor with the bitmap, growing
+*             the table if every entry is taken, and marks it in use. The
+*             entry is left cleared, with FD_IN_USE set in its flags
+*/
+int32_t fd_alloc(fd_table_t* table) {
+    while(1) {
+        uint32_t words = (table->size + 31) / 32;
+        uint32_t i;
+        for(i = 0; i < words; i++) {
+            if(table->used[i] == 0xFFFFFFFF) {
+                continue;
+            }
+
+            uint32_t fd = i * 32 + bsf(~(table->used[i]));
+            if(fd >= table->size) {
+                break; // Only the bits past the end of the table are free
+            }
+
+            table->used[i] |= (1 << (fd % 32));
+            memset(&(table->files[fd]), 0x00, sizeof(file_desc_t));
+            table->files[fd].flags = FD_IN_USE;
+            return fd;
+        }
+
+        if(fd_table_grow(table) == -1) {
+            return -1;
+        }
+    }
+}
+
+/*
+* void fd_free(fd_table_t* table, int32_t fd)
+*   Inputs:
+*   -table = file descriptor table
+*   -fd = file descriptor from fd_alloc
+*   Return Value: None
+*   Function: clears a file descriptor's entry and frees it for fd_alloc
+*/
+void fd_free(fd_table_t* table, int32_t fd) {
+    if((uint32_t) fd >= table->size) {
+        return;
+    }
+
+    memset(&(table->files[fd]), 0x00, sizeof(file_desc_t));
+    table->used[fd / 32] &= ~(1 << (fd % 32));
 }
 
 /*
-* pcb_t* get_pcb_ptr()
+* void fd_table_free(fd_table_t* table)
 *   Inputs:
-*   Return Value: pointer to the PCB if a process is running
-*   Function: grabs PCB
+*   -table = file descriptor table
+*   Return Value: None
+*   Function: gives the memory of a table that has grown back. Tables still
+*             in their owner's slots have nothing to free
+*/
+void fd_table_free(fd_table_t* table) {
+    if(table->size <= FILE_ARRAY_SIZE) {
+        return;
+    }
+
+    uint32_t frames = fd_table_frames(table->size);
+    if(frames == 0) {
+        kfree(table->files);
+    } else {
+        frame_free(table->files, frames);
+    }
+}
+
+/*
+* int32_t task_alloc_pid()
+*   Inputs: none
+*   Return Value: the new PID, or -1 if none are free or memory ran out
+*   Function: reserves the lowest free PID and allocates its PCB and kernel
+*             stack. Interrupts must be disabled
 */
-pcb_t* get_pcb_ptr() {
-
-    /*
-     * We only want to return the pcb pointer if we are running a process. If
-     * this function is called by the kernel before starting the shell, it will
-     * return NULL
-     */
-    int i;
-    for(i = 1; i <= MAX_TASKS; i++) {
-        if(pid_use_array[i] != 0) {
-            register uint32_t esp asm ("esp");
-            return (pcb_t*) (esp & 0xFFFFE000);
+int32_t task_alloc_pid() {
+    int32_t pid;
+    for(pid = 1; pid <= MAX_TASKS; pid++) {
+        if(pcb_table[pid] == NULL) {
+            break;
         }
     }
-    return NULL;
+    if(pid == MAX_TASKS + 1) {
+        log(ERROR, "Reached maximum number of tasks", "task_alloc_pid");
+        return -1;
+    }
+
+    pcb_t* pcb = kmem_cache_alloc(pcb_cache);
+    if(pcb == NULL) {
+        log(ERROR, "No memory for a PCB", "task_alloc_pid");
+        return -1;
+    }
+
+    uint8_t* stack = frame_alloc(TASK_STACK_SIZE / FRAME_SIZE, 1);
+    if(stack == NULL) {
+        log(ERROR, "No memory for a kernel stack", "task_alloc_pid");
+        kmem_cache_free(pcb_cache, pcb);
+        return -1;
+    }
+
+    pcb_table[pid] = pcb;
+    kernel_stacks[pid] = stack;
+    return pid;
+}
+
+/*
+* void task_free_pid(uint32_t pid)
+*   Inputs:
+*   -pid = process id
+*   Return Value: None
+*   Function: frees a PID, its PCB and its kernel stack. The task must not
+*             be running; a halting task is freed by task_reap once it has
+*             switched away
+*/
+void task_free_pid(uint32_t pid) {
+    if(pid == KERNEL_PID || pid > MAX_TASKS || pcb_table[pid] == NULL) {
+        return;
+    }
+
+    frame_free(kernel_stacks[pid], TASK_STACK_SIZE / FRAME_SIZE);
+    kmem_cache_free(pcb_cache, pcb_table[pid]);
+    pcb_table[pid] = NULL;
+    kernel_stacks[pid] = NULL;
+}
+
+/*
+* pcb_t* init_pcb(uint32_t pid)
+*   Inputs:
+*   -pid = process id
+*   Return Value: pointer to PCB data sctructure
+*   Function: initializes PCB for the given process ID as a copy of the
+*             template, so only the fields that differ need to be filled in
+*/
+pcb_t* init_pcb(uint32_t pid) {
+    pcb_t* pcb = get_pcb_ptr_pid(pid);
+    memcpy(pcb, &pcb_template, sizeof(pcb_t));
+
+    pcb->pid = pid;
+
+    // Stdin and stdout are already open, but in the template's slots
+    pcb->fds.files = pcb->file_slots;
+
+    return pcb;
 }
 
 /**
@@ -123,143 +293,367 @@ pcb_t* get_pcb_ptr() {
  * Output: returns pcb pointer
  */
 pcb_t* get_pcb_ptr_pid(uint32_t pid) {
-    return (pcb_t*) ((8 * MB) - ((pid + 1) * (8 * KB)));
+    return (pid == KERNEL_PID) ? BOOT_PCB : pcb_table[pid];
+}
+
+/**
+ * get_kernel_stack_pid(uint32_t pid)
+ * Decription: Gets the address the kernel stack of the pid starts at
+ * Input: pid - the pid
+ * Output: initial kernel stack pointer, as loaded into the TSS
+ */
+uint32_t get_kernel_stack_pid(uint32_t pid) {
+    uint8_t* stack = (pid == KERNEL_PID) ? (uint8_t*) BOOT_PCB : kernel_stacks[pid];
+    return ((uint32_t) stack) + TASK_STACK_SIZE - 4;
 }
 
 /*
-* file_desc_t* get_file_array()
+* void task_init_context(pcb_t* pcb, uint32_t entry_point)
 *   Inputs:
-*   Return Value: file descriptor array pointer
-*   Function: grabs the value of the file array for the given PCB
+*   -pcb = task that has never run
+*   -entry_point = address to start the program at
+*   Return Value: None
+*   Function: pushes an artificial IRET context for the program onto the
+*             task's kernel stack, and points its saved context at it so the
+*             first switch to the task goes to user mode
 */
-file_desc_t* get_file_array() {
-    pcb_t* pcb = get_pcb_ptr();
-    return (pcb == NULL) ? kernel_file_array : pcb->file_array;
+void task_init_context(pcb_t* pcb, uint32_t entry_point) {
+    uint32_t* stack = (uint32_t*) get_kernel_stack_pid(pcb->pid);
+
+    *(stack--) = USER_DS;         // Stack segment selector
+    *(stack--) = USER_STACK_ADDR; // Stack pointer
+    *(stack--) = USER_EFLAGS;     // EFLAGS (with IF set)
+    *(stack--) = USER_CS;         // Code segment selector
+    *stack = entry_point;         // EIP
+
+    memset(&(pcb->context), 0x00, sizeof(task_context_t));
+    pcb->context.esp = (uint32_t) stack;
+    pcb->context.eip = (uint32_t) task_enter_user;
 }
 
 /*
-* void task_switch(uint32_t new_pid)
+* void task_enqueue(pcb_t* pcb)
 *   Inputs:
-*   -new_pid = process ID to switch to
+*   -pcb = task to mark runnable
 *   Return Value: None
-*   Function: handles the bulk of the task switching
+*   Function: puts a task at the back of the run queue. Interrupts must be disabled
 */
-void task_switch(uint32_t new_pid, uint32_t switch_screen) {
-    cli(); // Begin critical section
-    disable_irq(PIT_IRQ);
-    log(DEBUG, "Switching to new task!", "task_switch");
-
-    if(new_pid == 0) {
-        log(ERROR, "Can't switch to kernel", "task_switch");
-        return;
+void task_enqueue(pcb_t* pcb) {
+    pcb->state = TASK_RUNNABLE;
+    pcb->next_runnable = NULL;
+
+    if(run_queue_tail == NULL) {
+        run_queue_head = pcb;
+    } else {
+        run_queue_tail->next_runnable = pcb;
     }
+    run_queue_tail = pcb;
+}
 
-    pcb_t* old_pcb = get_pcb_ptr();
-    if(old_pcb == NULL) {
-        log(ERROR, "Can't switch away from the kernel!", "task_switch");
-        return;
+/*
+* pcb_t* task_dequeue()
+*   Inputs: none
+*   Return Value: task at the front of the run queue, or NULL if it is empty
+*   Function: takes the next task to run off the run queue
+*/
+static pcb_t* task_dequeue() {
+    pcb_t* pcb = run_queue_head;
+    if(pcb != NULL) {
+        run_queue_head = pcb->next_runnable;
+        if(run_queue_head == NULL) {
+            run_queue_tail = NULL;
+        }
+        pcb->next_runnable = NULL;
     }
+    return pcb;
+}
 
-    if(old_pcb->pid == new_pid) {
-        log(WARN, "Can't switch to the current active task", "task_switch");
+/*
+* void task_switch(pcb_t* next)
+*   Inputs:
+*   -next = task to switch to, or NULL for the idle boot thread
+*   Return Value: None
+*   Function: handles the bulk of the task switching. Returns once the calling
+*             task is switched back to. Interrupts must be disabled
+*/
+void task_switch(pcb_t* next) {
+    pcb_t* curr = get_pcb_ptr();
+    if(next == curr) {
         return;
     }
 
-    // Mark the new task as the active task of the current terminal
-    active_pids[current_terminal] = new_pid;
+    uint32_t next_pid = (next == NULL) ? KERNEL_PID : next->pid;
 
     // Write TSS with new process's kernel stack
     tss.ss0 = KERNEL_DS;
-    tss.esp0 = ((8 * MB) - ((new_pid) * (8 * KB)) - 4);
-
-    // Get the PCB for the new task
-    pcb_t* new_pcb = (pcb_t*) ((8 * MB) - ((new_pid + 1) * (8 * KB)));
-
-    // Save esp/ebp in the PCB, and mark that we came from this function
-    register uint32_t esp asm ("esp");
-    old_pcb->switch_esp = esp;
-    register uint32_t ebp asm ("ebp");
-    old_pcb->switch_ebp = ebp;
-    old_pcb->from_task_switch = 1;
-
-    // Restore new process's paging
-    restore_parent_paging(old_pcb->pid, new_pid);
-
-    if(switch_screen) {
-        /*
-         * First, save the video memory from the current terminal to the backing
-         * store, as well as the cursor position. Then, remap the old tasks's
-         * VIDEO memory to the backing store and map new tasks's video memory to
-         * physical VIDEO addr
-         */
-        switch_active_terminal_screen((old_pcb == NULL) ? KERNEL_PID : old_pcb->pid, new_pid);
-        remap_video_memory(old_pcb->pid, new_pid);
-    }
-
-    /*
-     * If this kernel stack didn't leave off at task_switch code, we need to head
-     * back to sys_execute as that's where it left off. It should only have to return
-     * there once. This ensures the stack is dealt with properly.
-     */
-    if(!new_pcb->from_task_switch) { // Stack for parent process was stored in the old pcb
-        // Restore the stack of the parent process
-        asm volatile ("movl %0, %%esp;"::"r"(old_pcb->parent_esp));
-        asm volatile ("movl %0, %%ebp;"::"r"(old_pcb->parent_ebp));
-        asm volatile ("jmp halt_ret_lbl;");
-    }
-
-    log(DEBUG, "Returning from task_switch normally", "task_switch");
-
-    // Restore the stack of the new process
-    asm volatile ("movl %0, %%esp;"::"r"(new_pcb->switch_esp));
-    asm volatile ("movl %0, %%ebp;"::"r"(new_pcb->switch_ebp));
-
-    enable_irq(PIT_IRQ);
-    sti(); // End critical section
-    return;
+    tss.esp0 = get_kernel_stack_pid(next_pid);
+
+    if(next != NULL) {
+        next->timeslice = timeslice_ticks;
+    }
+
+    // Load new process's paging
+    set_page_dir(next_pid);
+
+    current_pcb = next;
+    context_switch((curr == NULL) ? &idle_context : &(curr->context),
+            (next == NULL) ? &idle_context : &(next->context));
+
+    // Switched back to curr. Free the task that halted to get here, if any, and
+    // if curr was killed in the meantime, finish it off now
+    task_reap();
+    task_check_killed();
+}
+
+/*
+* void task_schedule()
+*   Inputs: none
+*   Return Value: None
+*   Function: switches to the task at the front of the run queue, putting the
+*             current task at the back if it is still runnable. Falls back to
+*             the idle boot thread if nothing is runnable. Interrupts must be disabled
+*/
+void task_schedule() {
+    pcb_t* curr = get_pcb_ptr();
+    pcb_t* next = task_dequeue();
+
+    if(curr != NULL && curr->state == TASK_RUNNABLE) {
+        if(next == NULL) {
+            // Nothing else wants the CPU, so keep running
+            curr->timeslice = timeslice_ticks;
+            return;
+        }
+        task_enqueue(curr);
+    }
+
+    task_switch(next);
 }
 
 /*
 * void task_sched_next()
 *   Inputs:
 *   Return Value: None
-*   Function: schedule a task
+*   Function: called on every PIT tick. Preempts the running task once it
+*             has used up its time slice
 */
 void task_sched_next() {
-    return; // Comment this out to break everything :'(
+    pcb_t* pcb = get_pcb_ptr();
+    if(pcb != NULL && pcb->timeslice > 1) {
+        pcb->timeslice--;
+        return;
+    }
+
+    task_schedule();
+}
 
-    cli(); // Begin critical section
-    disable_irq(PIT_IRQ);
+/*
+* int32_t task_set_timeslice(uint32_t ticks)
+*   Inputs:
+*   -ticks = PIT ticks (1/TASK_SWITCH_FREQ seconds each) a task runs for
+*   Return Value: -1 on failure, 0 on success
+*   Function: changes the time slice, starting with each task's next turn
+*/
+int32_t task_set_timeslice(uint32_t ticks) {
+    if(ticks == 0) {
+        log(WARN, "Time slice must be at least one tick", "task_set_timeslice");
+        return -1;
+    }
+
+    timeslice_ticks = ticks;
+    return 0;
+}
+
+/*
+* void wait_queue_init(wait_queue_t* queue)
+*   Inputs:
+*   -queue = wait queue to set up
+*   Return Value: None
+*   Function: empties a wait queue
+*/
+void wait_queue_init(wait_queue_t* queue) {
+    queue->head = NULL;
+    queue->tail = NULL;
+}
+
+/*
+* void wait_queue_remove(wait_queue_t* queue, pcb_t* pcb)
+*   Inputs:
+*   -queue = wait queue the task is asleep on
+*   -pcb = task to take off the queue
+*   Return Value: None
+*   Function: takes a sleeping task off its wait queue without waking it
+*/
+static void wait_queue_remove(wait_queue_t* queue, pcb_t* pcb) {
+    pcb_t* prev = NULL;
+    pcb_t* curr = queue->head;
+
+    while(curr != NULL && curr != pcb) {
+        prev = curr;
+        curr = curr->next_runnable;
+    }
+    if(curr == NULL) {
+        return;
+    }
 
+    if(prev == NULL) {
+        queue->head = pcb->next_runnable;
+    } else {
+        prev->next_runnable = pcb->next_runnable;
+    }
+    if(queue->tail == pcb) {
+        queue->tail = prev;
+    }
+
+    pcb->next_runnable = NULL;
+    pcb->waiting_on = NULL;
+}
+
+/*
+* void task_sleep(wait_queue_t* queue)
+*   Inputs:
+*   -queue = wait queue to sleep on
+*   Return Value: None
+*   Function: puts the current task to sleep on a wait queue and runs
+*             something else until it is woken. Callers should recheck what
+*             they are waiting for afterwards, in a loop. Interrupts must be
+*             disabled
+*/
+void task_sleep(wait_queue_t* queue) {
     pcb_t* pcb = get_pcb_ptr();
     if(pcb == NULL) {
-        log(WARN, "Can't schedule in pre-shell kernel", "task_sched_next");
-        enable_irq(PIT_IRQ);
-        sti(); // End critical section
+        log(ERROR, "The kernel can't sleep", "task_sleep");
         return;
     }
 
-    uint32_t next_terminal = pcb->terminal_index + 1;
-    next_terminal %= 3;
+    pcb->state = TASK_WAITING;
+    pcb->waiting_on = queue;
+    pcb->next_runnable = NULL;
+
+    if(queue->tail == NULL) {
+        queue->head = pcb;
+    } else {
+        queue->tail->next_runnable = pcb;
+    }
+    queue->tail = pcb;
 
-    while(active_pids[next_terminal] == 0) {
-        // Increment next_terminal and loop around from 3 to 0
-        next_terminal++;
-        next_terminal %= 3;
+    task_schedule();
+}
 
-        if(next_terminal == pcb->terminal_index) {
-            // Looped through all the terminals and none were valid, so return
-            log(WARN, "No valid terminals found to switch to", "task_sched_next");
-            enable_irq(PIT_IRQ);
-            sti(); // End critical section
-            return;
+/*
+* void wait_queue_wake_all(wait_queue_t* queue)
+*   Inputs:
+*   -queue = wait queue to wake
+*   Return Value: None
+*   Function: moves every task asleep on a wait queue to the run queue.
+*             They run once the scheduler gets to them, so this is safe to
+*             call from interrupt handlers. Interrupts must be disabled
+*/
+void wait_queue_wake_all(wait_queue_t* queue) {
+    pcb_t* pcb = queue->head;
+    queue->head = NULL;
+    queue->tail = NULL;
+
+    while(pcb != NULL) {
+        pcb_t* next = pcb->next_runnable;
+        pcb->waiting_on = NULL;
+        task_enqueue(pcb);
+        pcb = next;
+    }
+}
+
+/*
+* void task_kill(uint32_t pid)
+*   Inputs:
+*   -pid = process ID to halt
+*   Return Value: None
+*   Function: halts the task right away if it is the one running, and
+*             otherwise marks it to halt as soon as it is switched back to.
+*             Interrupts must be disabled
+*/
+void task_kill(uint32_t pid) {
+    if(pid == KERNEL_PID || pid > MAX_TASKS || pcb_table[pid] == NULL ||
+            pcb_table[pid]->state == TASK_DEAD) {
+        return;
+    }
+
+    pcb_t* pcb = get_pcb_ptr_pid(pid);
+    if(pcb == get_pcb_ptr()) {
+        sys_halt(0);
+    } else {
+        pcb->halt_pending = 1;
+
+        // Don't leave it asleep waiting for input that may never come
+        if(pcb->waiting_on != NULL) {
+            wait_queue_remove(pcb->waiting_on, pcb);
+            task_enqueue(pcb);
         }
+    }
+}
+
+/*
+* void task_exit()
+*   Inputs: none
+*   Return Value: None
+*   Function: marks the running task dead. Its paging, PCB and kernel stack
+*             stay in use until it switches away for the last time, so
+*             task_reap frees them on whichever task runs next. Interrupts
+*             must be disabled
+*/
+void task_exit() {
+    pcb_t* curr = get_pcb_ptr();
+    curr->state = TASK_DEAD;
+    dead_pid = curr->pid;
+}
+
+/*
+* void task_reap()
+*   Inputs: none
+*   Return Value: None
+*   Function: frees the paging, PID, PCB and kernel stack of the task that
+*             halted last, now that nothing runs on them. Called whenever a
+*             task is switched to, including by task_enter_user. Interrupts
+*             must be disabled
+*/
+void task_reap() {
+    if(dead_pid == KERNEL_PID) {
+        return;
+    }
+
+    free_task_paging(dead_pid);
+    task_free_pid(dead_pid);
+    dead_pid = KERNEL_PID;
+}
 
+/*
+* void task_check_killed()
+*   Inputs: none
+*   Return Value: None (doesn't return if the task was killed)
+*   Function: halts the running task if task_kill marked it while it wasn't
+*             running. Called whenever a task is switched to, including by
+*             task_enter_user for a task that has never run. Interrupts must
+*             be disabled
+*/
+void task_check_killed() {
+    pcb_t* curr = get_pcb_ptr();
+    if(curr != NULL && curr->halt_pending) {
+        sys_halt(0);
     }
+}
 
-    // Found a valid terminal, now switch to it!
-    task_switch(active_pids[next_terminal], NO_SWITCH_SCREEN);
+/*
+* void task_idle()
+*   Inputs: none
+*   Return Value: None (never returns)
+*   Function: turns the calling boot thread into the idle loop, which hands
+*             the CPU to any runnable task and halts until the next interrupt
+*             otherwise
+*/
+void task_idle() {
+    while(1) {
+        cli();
+        task_schedule();
 
-    enable_irq(PIT_IRQ);
-    sti(); // End critical section
+        // sti only takes effect after hlt, so no interrupt can slip in between
+        asm volatile ("sti; hlt;");
+    }
 }
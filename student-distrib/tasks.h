@@ -12,73 +12,257 @@
 #include "x86_desc.h"
 #include "paging.h"
 #include "devices/i8259.h"
+#include "frames.h"
 
 #define STDIN_FD  0
 #define STDOUT_FD 1
 
+// File descriptors a task has room for in its PCB, before its table grows
 #define FILE_ARRAY_SIZE 8
 
-#define MAX_TASKS 6
+// Most file descriptors a task can have. Grown tables come from the frame allocator
+#define FILE_ARRAY_MAX 256
+
+#define FD_BITMAP_WORDS (FILE_ARRAY_MAX / 32)
+
+// file_desc_t flag set while the file descriptor is open
+#define FD_IN_USE 0x1
+
+/*
+ * Largest PID. How many tasks can actually run at once depends on how much
+ * physical memory is installed, as each takes a kernel stack and its program
+ * pages from the frame allocator
+ */
+#define MAX_TASKS 1023
+
+// Size of a kernel stack. A task's PCB comes from a slab cache, apart from its stack
+#define TASK_STACK_SIZE (8 * KB)
+
+// PCB slot at the bottom of the boot stack, which the boot thread runs on
+#define BOOT_PCB ((pcb_t*) (EIGHT_MB - TASK_STACK_SIZE))
 
 #define KERNEL_PID 0
 
 #define MAX_ARGS_LENGTH 128
 
-#define SWITCH_SCREEN 1
-#define NO_SWITCH_SCREEN 0
+// PIT interrupts per second
+#define TASK_SWITCH_FREQ 100
 
-#define TASK_SWITCH_FREQ 10
+// Default number of PIT ticks a task runs for before it is preempted
+#define TASK_TIMESLICE_TICKS 3
 
-// Struct for file descriptor array entry
+// Task states
+#define TASK_RUNNABLE 0
+#define TASK_WAITING  1
+#define TASK_DEAD     2
+
+// EFLAGS a program starts with (IF set, plus the always-one bit 1)
+#define USER_EFLAGS 0x202
+
+// Initial user stack pointer, at the top of the program window
+#define USER_STACK_ADDR (USER_PAGE_VIRT + FOUR_MB - 4)
+
+// 4KB pages in the program window
+#define USER_WINDOW_PAGES (FOUR_MB / FOUR_KB)
+
+// Loadable segments of a program a task remembers
+#define TASK_MAX_SEGMENTS 8
+
+// Where in the executable a loadable segment is filled in from. Past filesz it is zero
+typedef struct {
+    uint32_t vaddr;
+    uint32_t offset;
+    uint32_t filesz;
+} task_segment_t;
+
+// Top of the program window kept for the stack. The heap can't grow into it, and the stack can't grow past it
+#define USER_STACK_RESERVE (64 * KB)
+#define USER_HEAP_END (USER_PAGE_VIRT + FOUR_MB - USER_STACK_RESERVE)
+
+// Operations of a type of file, shared by every file descriptor of that type
 typedef struct {
     int32_t (*read)(int32_t fd, void* buf, int32_t nbytes);
     int32_t (*write)(int32_t fd, const void* buf, int32_t nbytes);
     int32_t (*open)(const uint8_t* filename);
     int32_t (*close)(int32_t fd);
+} file_ops_t;
+
+// Operations tables of each file type, defined by their drivers
+extern const file_ops_t terminal_ops;
+extern const file_ops_t rtc_ops;
+extern const file_ops_t fs_dir_ops;
+extern const file_ops_t fs_file_ops;
+
+// Struct for file descriptor array entry
+typedef struct {
+    const file_ops_t* ops;
     uint32_t inode_num;
     uint32_t file_pos;
     uint32_t flags;
+    uint32_t rtc_interval; // RTC files only: hardware ticks per virtual tick
 } file_desc_t;
 
-//struct for process ID
+// File descriptor table of a task (or the kernel)
 typedef struct {
+    file_desc_t* files;  // Entries, the owner's FILE_ARRAY_SIZE slots until the table grows
+    uint32_t size;       // Number of entries in files
+    uint32_t used[FD_BITMAP_WORDS]; // One bit per file descriptor, set while it is open
+} fd_table_t;
+
+// Kernel registers saved for a task while it isn't running. Field order is used by tasks_asm.S
+typedef struct {
+    uint32_t ebx;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t ebp;
+    uint32_t esp;
+    uint32_t eip;
+} task_context_t;
+
+//struct for process ID
+typedef struct pcb {
     uint32_t pid;
-    file_desc_t file_array[FILE_ARRAY_SIZE];
+    fd_table_t fds;
+    file_desc_t file_slots[FILE_ARRAY_SIZE]; // Where fds starts out
     uint32_t parent_pid;
-    uint32_t parent_esp;
-    uint32_t parent_ebp;
     uint8_t args[MAX_ARGS_LENGTH];
     uint32_t terminal_index;
-    uint32_t from_task_switch;
-    uint32_t switch_esp;
-    uint32_t switch_ebp;
+    task_context_t context;
+    uint32_t state;
+    uint32_t timeslice;        // PIT ticks left before the task is preempted
+    uint32_t halt_pending;     // Set when the task is killed while it isn't running
+    uint32_t child_status;     // Status passed to halt by the last child
+    struct pcb* next_runnable; // Next task on the run queue or wait queue
+    struct wait_queue* waiting_on; // Wait queue the task is asleep on, if any
+    uint32_t exe_inode;        // Executable the program window is filled in from as it is touched
+    uint32_t exe_length;
+    uint32_t num_segments;     // 0 if the program headers couldn't be read, and the file is loaded as is
+    task_segment_t segments[TASK_MAX_SEGMENTS];
+    uint32_t exe_shared[USER_WINDOW_PAGES / 32]; // Pages mapped straight from the filesystem image
+    uint32_t heap_start;       // Page after the program, where the heap starts
+    uint32_t brk;              // End of the heap, moved by sbrk
 } pcb_t;
 
+// Tasks asleep until some event happens, oldest first
+typedef struct wait_queue {
+    pcb_t* head;
+    pcb_t* tail;
+} wait_queue_t;
+
 // File descriptor table used by the kernel (will probably be moved later)
 extern file_desc_t kernel_file_array[FILE_ARRAY_SIZE];
+extern fd_table_t kernel_fds;
+
+// PCB of the running task, NULL for the boot thread. Set by task_switch
+extern pcb_t* current_pcb;
 
-// Table used to track which PIDs are in use
-extern uint32_t pid_use_array[MAX_TASKS + 1];
+// PCB of each PID in use, NULL for free PIDs
+extern pcb_t* pcb_table[MAX_TASKS + 1];
 
 // initialize the kernel file array
 void init_kernel_file_array();
 
+// set up a file descriptor table with stdin and stdout open
+void fd_table_init(fd_table_t* table, file_desc_t* slots);
+
+// reserve the lowest free file descriptor, growing the table if it is full
+int32_t fd_alloc(fd_table_t* table);
+
+// clear a file descriptor and make it free again
+void fd_free(fd_table_t* table, int32_t fd);
+
+// give back the memory of a table that has grown
+void fd_table_free(fd_table_t* table);
+
+// reserve a free PID and allocate its kernel stack
+int32_t task_alloc_pid();
+
+// free a PID and its kernel stack
+void task_free_pid(uint32_t pid);
+
 // initiliaze the pbc
 pcb_t* init_pcb(uint32_t pid);
 
 // get the pcb pointer
-pcb_t* get_pcb_ptr();
+static inline pcb_t* get_pcb_ptr() {
+    return current_pcb;
+}
 
 // the the pcb pointer to the pid
 pcb_t* get_pcb_ptr_pid(uint32_t pid);
 
+// get the file descriptor table of the current task
+static inline fd_table_t* get_fd_table() {
+    return (current_pcb == NULL) ? &kernel_fds : &(current_pcb->fds);
+}
+
 // get file array
-file_desc_t* get_file_array();
+static inline file_desc_t* get_file_array() {
+    return get_fd_table()->files;
+}
+
+// get an open file descriptor of the current task, NULL if fd isn't open
+static inline file_desc_t* get_file_desc(int32_t fd) {
+    fd_table_t* table = get_fd_table();
+
+    // Negative fds turn into huge unsigned ones, so one compare checks both ends
+    if((uint32_t) fd >= table->size) {
+        return NULL;
+    }
+
+    file_desc_t* file = &(table->files[fd]);
+    return (file->flags & FD_IN_USE) ? file : NULL;
+}
+
+// get the top of the kernel stack of the pid
+uint32_t get_kernel_stack_pid(uint32_t pid);
+
+// set up a new task to enter its program the first time it is switched to
+void task_init_context(pcb_t* pcb, uint32_t entry_point);
+
+// add a task to the back of the run queue
+void task_enqueue(pcb_t* pcb);
 
 // switch tasks
-void task_switch(uint32_t new_pid, uint32_t switch_screen);
+void task_switch(pcb_t* next);
+
+// give up the CPU to the next runnable task
+void task_schedule();
 
 //schedule next task
 void task_sched_next();
 
+// set the number of PIT ticks each task runs for
+int32_t task_set_timeslice(uint32_t ticks);
+
+// halt a task, now if it is running or the next time it runs otherwise
+void task_kill(uint32_t pid);
+
+// mark the running task dead, to be freed once it has switched away
+void task_exit();
+
+// free the task that halted last, once something else runs
+void task_reap();
+
+// halt the running task if it was killed while it wasn't running
+void task_check_killed();
+
+// set up an empty wait queue
+void wait_queue_init(wait_queue_t* queue);
+
+// put the current task to sleep on a wait queue until it is woken
+void task_sleep(wait_queue_t* queue);
+
+// make every task asleep on a wait queue runnable again
+void wait_queue_wake_all(wait_queue_t* queue);
+
+// run the scheduler from the boot thread whenever nothing else is runnable
+void task_idle();
+
+// save the current context in old and resume new - in tasks_asm.S
+extern void context_switch(task_context_t* old, task_context_t* new);
+
+// first code run by a new task - in tasks_asm.S
+extern void task_enter_user();
+
 #endif // TASKS_H
@@ -8,22 +8,25 @@ int main ()
     int32_t fd, cnt;
     uint8_t buf[1024];
 
+    /* only write to the terminal in whole buffers */
+    ece391_setvbuf (ece391_stdout, ECE391_IOFBF);
+
     if (0 != ece391_getargs (buf, 1024)) {
-        ece391_fdputs (1, (uint8_t*)"could not read arguments\n");
+        ece391_fputs ((uint8_t*)"could not read arguments\n", ece391_stdout);
 	return 3;
     }
 
     if (-1 == (fd = ece391_open (buf))) {
-        ece391_fdputs (1, (uint8_t*)"file not found\n");
+        ece391_fputs ((uint8_t*)"file not found\n", ece391_stdout);
 	return 2;
     }
 
     while (0 != (cnt = ece391_read (fd, buf, 1024))) {
         if (-1 == cnt) {
-	    ece391_fdputs (1, (uint8_t*)"file read failed\n");
+	    ece391_fputs ((uint8_t*)"file read failed\n", ece391_stdout);
 	    return 3;
 	}
-	if (-1 == ece391_write (1, buf, cnt))
+	if (-1 == ece391_fwrite (buf, cnt, ece391_stdout))
 	    return 3;
     }
 
@@ -49,6 +49,8 @@ DO_CALL(ece391_halt,1 /* SYS_HALT */);
 DO_CALL(__ece391_read,3 /* SYS_READ */);
 DO_CALL(__ece391_write,4 /* SYS_WRITE */);
 DO_CALL(__ece391_close,6 /* SYS_CLOSE */);
+DO_CALL(ece391_readv,145 /* Linux readv */);
+DO_CALL(ece391_writev,146 /* Linux writev */);
 
 /* Call the main() function, then halt with its return value. */
 
@@ -56,8 +58,10 @@ asm volatile ("                         \n\
 .GLOBAL _start                          \n\
 _start:                                 \n\
 	MOVL	%ESP,start_esp          \n\
+	CALL	ece391_stdio_init       \n\
         CALL	main                    \n\
 	PUSHL	%EAX                    \n\
+	CALL	ece391_fflush_all       \n\
 	CALL	ece391_halt             \n\
 ");
 
@@ -225,3 +229,22 @@ ece391_close (int32_t fd)
     return 0;
 }
 
+
+void* 
+ece391_sbrk (int32_t increment)
+{
+    static uint32_t cur_brk = 0;
+    uint32_t new_brk;
+    uint32_t old_brk;
+
+    /* Linux brk returns the new break, not the old one as sbrk does */
+    if (0 == cur_brk)
+	asm volatile ("INT $0x80" : "=a" (cur_brk) : "a" (45), "b" (0));
+    old_brk = cur_brk;
+    asm volatile ("INT $0x80" : "=a" (new_brk) : 
+		  "a" (45), "b" (old_brk + increment));
+    if (new_brk != old_brk + increment)
+        return (void*)-1;
+    cur_brk = new_brk;
+    return (void*)old_brk;
+}
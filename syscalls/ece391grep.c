@@ -2,64 +2,73 @@
 
 #include "ece391support.h"
 #include "ece391syscall.h"
+#include "ece391malloc.h"
 
 #define BUFSIZE 1024
 #define SBUFSIZE 33
 
+/*
+ * Read a whole line of any length into *line, growing it as needed, and
+ * return its length (0 at the end of the file, -1 on failure).
+ */
+static int32_t
+read_line (uint8_t** line, uint32_t* size, ece391_file_t* f)
+{
+    int32_t len = 0, cnt;
+    uint8_t* bigger;
+
+    while (1) {
+        if (-1 == (cnt = ece391_fgets (*line + len, *size - len, f)))
+	    return -1;
+	len += cnt;
+	if (0 == cnt || '\n' == (*line)[len - 1] || len < *size - 1)
+	    return len;
+	/* the line didn't fit: double the buffer and keep reading */
+	if (0 == (bigger = ece391_realloc (*line, *size * 2)))
+	    return -1;
+	*line = bigger;
+	*size *= 2;
+    }
+}
+
 int32_t
-do_one_file (const char* s, const char* fname) 
+do_one_file (const char* s, const char* fname, uint8_t** line, uint32_t* size)
 {
-    int32_t fd, cnt, last, line_start, line_end, check, s_len;
-    uint8_t data[BUFSIZE+1];
+    int32_t fd, cnt, check, s_len;
+    ece391_file_t* f;
 
     s_len = ece391_strlen ((uint8_t*)s);
     if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
-        ece391_fdputs (1, (uint8_t*)"file open failed\n");
+        ece391_fputs ((uint8_t*)"file open failed\n", ece391_stdout);
         return -1;
     }
-    last = 0;
-    while (1) {
-        cnt = ece391_read (fd, data + last, BUFSIZE - last);
+    if (0 == (f = ece391_fdopen (fd, ECE391_IOFBF))) {
+        ece391_fputs ((uint8_t*)"out of files\n", ece391_stdout);
+        (void)ece391_close (fd);
+        return -1;
+    }
+    while (0 != (cnt = read_line (line, size, f))) {
 	if (-1 == cnt) {
-            ece391_fdputs (1, (uint8_t*)"file read failed\n");
+            ece391_fputs ((uint8_t*)"file read failed\n", ece391_stdout);
+            (void)ece391_fclose (f);
             return -1;
 	}
-	last += cnt;
-	line_start = 0;
-	while (1) {
-	    line_end = line_start;
-	    while (line_end < last && '\n' != data[line_end])
-		line_end++;
-	    if ('\n' != data[line_end] && 0 != cnt && line_start != 0) {
-		/* copy from line_start to last down to 0 and fix last */
-		data[line_end] = '\0';
-		ece391_strcpy (data, data + line_start);
-		last -= line_start;
-		break;
-	    }
-	    /* search the line */
-	    data[line_end] = '\0';
-	    for (check = line_start; check < line_end; check++) {
-		if (s[0] == data[check] && 
-		    0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
-		    ece391_fdputs (1, (uint8_t*)fname);
-		    ece391_fdputs (1, (uint8_t*)":");
-		    ece391_fdputs (1, data + line_start);
-		    ece391_fdputs (1, (uint8_t*)"\n");
-		    break;
-		}
-	    }
-	    line_start = line_end + 1;
-	    if (line_start >= last) {
-	        last = 0;
+	if ('\n' == (*line)[cnt - 1])
+	    (*line)[--cnt] = '\0';
+	/* search the line */
+	for (check = 0; check < cnt; check++) {
+	    if (s[0] == (*line)[check] && 
+		0 == ece391_strncmp (*line + check, (uint8_t*)s, s_len)) {
+		ece391_fputs ((uint8_t*)fname, ece391_stdout);
+		ece391_fputc (':', ece391_stdout);
+		ece391_fwrite (*line, cnt, ece391_stdout);
+		ece391_fputc ('\n', ece391_stdout);
 		break;
 	    }
 	}
-	if (0 == cnt)
-	    break;
     }
-    if (-1 == ece391_close (fd)) {
-        ece391_fdputs (1, (uint8_t*)"file close failed\n");
+    if (-1 == ece391_fclose (f)) {
+        ece391_fputs ((uint8_t*)"file close failed\n", ece391_stdout);
         return -1;
     }
     return 0;
@@ -70,26 +79,37 @@ int main ()
     int32_t fd, cnt;
     uint8_t buf[SBUFSIZE];
     uint8_t search[BUFSIZE];
+    uint32_t line_size = BUFSIZE;
+    uint8_t* line;
+
+    /* matches are written out a buffer at a time, not a line at a time */
+    ece391_setvbuf (ece391_stdout, ECE391_IOFBF);
 
     if (0 != ece391_getargs (search, BUFSIZE)) {
-        ece391_fdputs (1, (uint8_t*)"could not read argument\n");
+        ece391_fputs ((uint8_t*)"could not read argument\n", ece391_stdout);
+        return 3;
+    }
+
+    /* one line buffer for every file, grown to the longest line seen */
+    if (0 == (line = ece391_malloc (line_size))) {
+        ece391_fputs ((uint8_t*)"out of memory\n", ece391_stdout);
         return 3;
     }
 
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
-        ece391_fdputs (1, (uint8_t*)"directory open failed\n");
+        ece391_fputs ((uint8_t*)"directory open failed\n", ece391_stdout);
 	return 2;
     }
 
     while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
         if (-1 == cnt) {
-	    ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
+	    ece391_fputs ((uint8_t*)"directory entry read failed\n", ece391_stdout);
 	    return 3;
 	}
 	if ('.' == buf[0]) /* a directory... */
 	    continue;
 	buf[cnt] = '\0';
-	if (0 != do_one_file ((char*)search, (char*)buf))
+	if (0 != do_one_file ((char*)search, (char*)buf, &line, &line_size))
 	    return 3;
     }
 
@@ -10,18 +10,21 @@ int main ()
     int32_t fd, cnt;
     uint8_t buf[SBUFSIZE];
 
+    /* one write for many entries instead of one per entry */
+    ece391_setvbuf (ece391_stdout, ECE391_IOFBF);
+
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
-        ece391_fdputs (1, (uint8_t*)"directory open failed\n");
+        ece391_fputs ((uint8_t*)"directory open failed\n", ece391_stdout);
         return 2;
     }
 
     while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
         if (-1 == cnt) {
-	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
+	        ece391_fputs ((uint8_t*)"directory entry read failed\n", ece391_stdout);
 	        return 3;
 	    }
 	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
+	    if (-1 == ece391_fwrite (buf, cnt + 1, ece391_stdout))
 	        return 3;
     }
 
@@ -0,0 +1,124 @@
+#include <stdint.h>
+
+#include "ece391malloc.h"
+#include "ece391syscall.h"
+
+/*
+ * Every block starts with a header holding its usable size, which is
+ * followed by the memory handed out.  While a block is free, next links
+ * it into the free list it is on.
+ */
+typedef struct ece391_block_t {
+    uint32_t size;
+    struct ece391_block_t* next;
+} ece391_block_t;
+
+static ece391_block_t* ece391_small_free[ECE391_MALLOC_CLASSES];
+static ece391_block_t* ece391_large_free = 0;
+
+/* Heap left over from the last chunk taken for small blocks */
+static uint8_t* ece391_arena = 0;
+static uint32_t ece391_arena_left = 0;
+
+/* Take a block with room for size bytes from the heap */
+static ece391_block_t* ece391_morecore(uint32_t size)
+{
+    uint32_t need = sizeof(ece391_block_t) + size;
+    ece391_block_t* block;
+    void* mem;
+
+    if (size > ECE391_MALLOC_MAX_SMALL) {
+        if ((void*)-1 == (mem = ece391_sbrk(need)))
+            return 0;
+        block = mem;
+    } else {
+        if (ece391_arena_left < need) {
+            /* whatever is left of the old chunk is dropped */
+            if ((void*)-1 == (mem = ece391_sbrk(ECE391_MALLOC_CHUNK)))
+                return 0;
+            ece391_arena = mem;
+            ece391_arena_left = ECE391_MALLOC_CHUNK;
+        }
+        block = (ece391_block_t*)ece391_arena;
+        ece391_arena += need;
+        ece391_arena_left -= need;
+    }
+    block->size = size;
+    return block;
+}
+
+/* Allocate size bytes, or return 0 if the heap can't grow */
+void* ece391_malloc(uint32_t size)
+{
+    ece391_block_t* block;
+    ece391_block_t** prev;
+    int32_t class;
+
+    if (0 == size)
+        return 0;
+
+    if (size <= ECE391_MALLOC_MAX_SMALL) {
+        for (class = 0; (1 << (ECE391_MALLOC_MIN_SHIFT + class)) < size; class++);
+        if (0 != (block = ece391_small_free[class])) {
+            ece391_small_free[class] = block->next;
+        } else if (0 == (block = ece391_morecore(1 << (ECE391_MALLOC_MIN_SHIFT + class)))) {
+            return 0;
+        }
+        return block + 1;
+    }
+
+    /* round up so headers stay aligned */
+    size = (size + 7) & ~7;
+    for (prev = &ece391_large_free; 0 != *prev; prev = &(*prev)->next) {
+        if ((*prev)->size >= size) {
+            block = *prev;
+            *prev = block->next;
+            return block + 1;
+        }
+    }
+    if (0 == (block = ece391_morecore(size)))
+        return 0;
+    return block + 1;
+}
+
+/* Give back memory from ece391_malloc or ece391_realloc */
+void ece391_free(void* ptr)
+{
+    ece391_block_t* block;
+    int32_t class;
+
+    if (0 == ptr)
+        return;
+    block = (ece391_block_t*)ptr - 1;
+    if (block->size <= ECE391_MALLOC_MAX_SMALL) {
+        for (class = 0; (1 << (ECE391_MALLOC_MIN_SHIFT + class)) < block->size; class++);
+        block->next = ece391_small_free[class];
+        ece391_small_free[class] = block;
+    } else {
+        block->next = ece391_large_free;
+        ece391_large_free = block;
+    }
+}
+
+/*
+ * Resize memory from ece391_malloc, moving it if it doesn't fit where it
+ * is.  Returns 0, leaving the old memory alone, if the heap can't grow.
+ */
+void* ece391_realloc(void* ptr, uint32_t size)
+{
+    ece391_block_t* block;
+    uint8_t* new_ptr;
+    uint32_t i;
+
+    if (0 == ptr)
+        return ece391_malloc(size);
+    block = (ece391_block_t*)ptr - 1;
+    if (size <= block->size)
+        return ptr;
+    if (0 == (new_ptr = ece391_malloc(size)))
+        return 0;
+    for (i = 0; i < block->size; i++)
+        new_ptr[i] = ((uint8_t*)ptr)[i];
+    ece391_free(ptr);
+    return new_ptr;
+}
@@ -0,0 +1,20 @@
+#if !defined(ECE391MALLOC_H)
+#define ECE391MALLOC_H
+
+/*
+ * Dynamic memory, carved out of the heap ece391_sbrk hands out.  Requests
+ * up to ECE391_MALLOC_MAX_SMALL bytes are rounded up to a power of two
+ * and kept on a free list per size once freed, so they are reused in
+ * constant time.  Larger ones get a block of their own, reused first-fit
+ * once freed.  Memory is never given back to the kernel.
+ */
+#define ECE391_MALLOC_CLASSES   8     /* 16, 32, ... 2048 bytes */
+#define ECE391_MALLOC_MIN_SHIFT 4
+#define ECE391_MALLOC_MAX_SMALL (1 << (ECE391_MALLOC_MIN_SHIFT + ECE391_MALLOC_CLASSES - 1))
+#define ECE391_MALLOC_CHUNK     4096  /* heap taken at a time for small blocks */
+
+extern void* ece391_malloc(uint32_t size);
+extern void ece391_free(void* ptr);
+extern void* ece391_realloc(void* ptr, uint32_t size);
+
+#endif /* ECE391MALLOC_H */
@@ -9,12 +9,12 @@ int main ()
 {
     int32_t cnt, rval;
     uint8_t buf[BUFSIZE];
-    ece391_fdputs (1, (uint8_t*)"Starting 391 Shell\n");
+    ece391_fputs ((uint8_t*)"Starting 391 Shell\n", ece391_stdout);
 
     while (1) {
-        ece391_fdputs (1, (uint8_t*)"391OS> ");
-	if (-1 == (cnt = ece391_read (0, buf, BUFSIZE-1))) {
-	    ece391_fdputs (1, (uint8_t*)"read from keyboard failed\n");
+        ece391_fputs ((uint8_t*)"391OS> ", ece391_stdout);
+	if (-1 == (cnt = ece391_fgets (buf, BUFSIZE, ece391_stdin))) {
+	    ece391_fputs ((uint8_t*)"read from keyboard failed\n", ece391_stdout);
 	    return 3;
 	}
 	if (cnt > 0 && '\n' == buf[cnt - 1])
@@ -24,13 +24,14 @@ int main ()
 	    return 0;
 	if ('\0' == buf[0])
 	    continue;
+	ece391_fflush (ece391_stdout);
 	rval = ece391_execute (buf);
 	if (-1 == rval)
-	    ece391_fdputs (1, (uint8_t*)"no such command\n");
+	    ece391_fputs ((uint8_t*)"no such command\n", ece391_stdout);
 	else if (256 == rval)
-	    ece391_fdputs (1, (uint8_t*)"program terminated by exception\n");
+	    ece391_fputs ((uint8_t*)"program terminated by exception\n", ece391_stdout);
 	else if (0 != rval)
-	    ece391_fdputs (1, (uint8_t*)"program terminated abnormally\n");
+	    ece391_fputs ((uint8_t*)"program terminated abnormally\n", ece391_stdout);
     }
 }
 
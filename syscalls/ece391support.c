@@ -102,3 +102,184 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+static ece391_file_t ece391_files[ECE391_FOPEN_MAX];
+
+ece391_file_t* const ece391_stdin = &ece391_files[0];
+ece391_file_t* const ece391_stdout = &ece391_files[1];
+
+/*
+ * Open stdin and stdout, which take the first two files.  _start does
+ * this at run time instead of leaving it to an initializer, so it
+ * doesn't depend on the loader filling in the program's .data.
+ */
+void ece391_stdio_init(void)
+{
+    (void)ece391_fdopen(0, ECE391_IOLBF);
+    (void)ece391_fdopen(1, ECE391_IOLBF);
+}
+
+/* Wrap an open file descriptor in a buffered file */
+ece391_file_t* ece391_fdopen(int32_t fd, int32_t mode)
+{
+    int32_t i;
+
+    for (i = 0; i < ECE391_FOPEN_MAX; i++) {
+        if (!ece391_files[i].in_use) {
+            ece391_files[i].in_use = 1;
+            ece391_files[i].fd = fd;
+            ece391_files[i].mode = mode;
+            ece391_files[i].out_len = 0;
+            ece391_files[i].in_pos = 0;
+            ece391_files[i].in_len = 0;
+            return &ece391_files[i];
+        }
+    }
+    return 0;
+}
+
+/* Flush a file, then close it and its file descriptor */
+int32_t ece391_fclose(ece391_file_t* f)
+{
+    int32_t rval = ece391_fflush(f);
+
+    if (-1 == ece391_close(f->fd))
+        rval = -1;
+    f->in_use = 0;
+    return rval;
+}
+
+/* Change how a file is buffered, writing out anything already buffered */
+int32_t ece391_setvbuf(ece391_file_t* f, int32_t mode)
+{
+    if (ECE391_IONBF != mode && ECE391_IOLBF != mode && ECE391_IOFBF != mode)
+        return -1;
+    if (-1 == ece391_fflush(f))
+        return -1;
+    f->mode = mode;
+    return 0;
+}
+
+/* Write out everything buffered for a file */
+int32_t ece391_fflush(ece391_file_t* f)
+{
+    uint32_t len = f->out_len;
+
+    if (0 == len)
+        return 0;
+    f->out_len = 0;
+    return (-1 == ece391_write(f->fd, f->buf, len)) ? -1 : 0;
+}
+
+/* Flush every open file, before the program halts */
+void ece391_fflush_all(void)
+{
+    int32_t i;
+
+    for (i = 0; i < ECE391_FOPEN_MAX; i++) {
+        if (ece391_files[i].in_use)
+            (void)ece391_fflush(&ece391_files[i]);
+    }
+}
+
+int32_t ece391_fwrite(const void* buf, uint32_t n, ece391_file_t* f)
+{
+    const uint8_t* data = buf;
+    uint32_t i;
+
+    /* Writes as big as the buffer gain nothing from copying */
+    if (ECE391_IONBF == f->mode || n >= ECE391_BUFSIZ) {
+        if (-1 == ece391_fflush(f))
+            return -1;
+        return ece391_write(f->fd, buf, n);
+    }
+
+    if (f->out_len + n > ECE391_BUFSIZ && -1 == ece391_fflush(f))
+        return -1;
+    for (i = 0; i < n; i++)
+        f->buf[f->out_len++] = data[i];
+
+    if (ECE391_IOLBF == f->mode) {
+        for (i = 0; i < n; i++) {
+            if ('\n' == data[i])
+                return (-1 == ece391_fflush(f)) ? -1 : (int32_t)n;
+        }
+    }
+    return n;
+}
+
+int32_t ece391_fputs(const uint8_t* s, ece391_file_t* f)
+{
+    return ece391_fwrite(s, ece391_strlen(s), f);
+}
+
+int32_t ece391_fputc(uint8_t c, ece391_file_t* f)
+{
+    return ece391_fwrite(&c, 1, f);
+}
+
+/*
+ * Refill a file's input buffer with one read.  Output that is waiting
+ * for a newline is written out first, so prompts show up before the
+ * program blocks on input.
+ */
+static int32_t ece391_fill(ece391_file_t* f)
+{
+    int32_t cnt;
+
+    if (ECE391_IOLBF == ece391_stdout->mode)
+        (void)ece391_fflush(ece391_stdout);
+    if (-1 == (cnt = ece391_read(f->fd, f->buf, ECE391_BUFSIZ)))
+        return -1;
+    f->in_pos = 0;
+    f->in_len = cnt;
+    return cnt;
+}
+
+int32_t ece391_fread(void* buf, uint32_t n, ece391_file_t* f)
+{
+    uint8_t* data = buf;
+    uint32_t copied;
+    int32_t cnt;
+
+    if (f->in_pos == f->in_len) {
+        /* Reads as big as the buffer go straight through */
+        if (ECE391_IONBF == f->mode || n >= ECE391_BUFSIZ) {
+            if (ECE391_IOLBF == ece391_stdout->mode)
+                (void)ece391_fflush(ece391_stdout);
+            return ece391_read(f->fd, buf, n);
+        }
+        if (0 >= (cnt = ece391_fill(f)))
+            return cnt;
+    }
+
+    for (copied = 0; copied < n && f->in_pos < f->in_len; copied++)
+        data[copied] = f->buf[f->in_pos++];
+    return copied;
+}
+
+/*
+ * Read a line, including its newline, into s as a string of at most n - 1
+ * characters.  Returns the number of characters read, 0 at the end of the
+ * file, or -1 if a read fails.
+ */
+int32_t ece391_fgets(uint8_t* s, int32_t n, ece391_file_t* f)
+{
+    int32_t copied = 0;
+    int32_t cnt;
+
+    if (n <= 0)
+        return -1;
+    while (copied < n - 1) {
+        if (f->in_pos == f->in_len) {
+            if (-1 == (cnt = ece391_fill(f)))
+                return -1;
+            if (0 == cnt)
+                break;
+        }
+        s[copied] = f->buf[f->in_pos++];
+        if ('\n' == s[copied++])
+            break;
+    }
+    s[copied] = '\0';
+    return copied;
+}
@@ -9,5 +9,46 @@ extern int32_t ece391_strncmp(const uint8_t* s1, const uint8_t* s2, uint32_t n);
 extern uint8_t *ece391_itoa(uint32_t value, uint8_t* buf, int32_t radix);
 extern uint8_t *ece391_strrev(uint8_t* s);
 
+/*
+ * Buffered input and output.  Output to a line buffered file is written
+ * out whenever a newline is put in it, and to a fully buffered one only
+ * once its buffer fills up.  Everything left is written out by
+ * ece391_fflush_all, which _start calls when main returns, and line
+ * buffered output is also flushed before a buffered read has to wait for
+ * input.  stdin and stdout are opened line buffered by ece391_stdio_init,
+ * which _start calls before main.
+ */
+#define ECE391_BUFSIZ      1024
+#define ECE391_FOPEN_MAX   8
+
+#define ECE391_IONBF       0   /* unbuffered */
+#define ECE391_IOLBF       1   /* line buffered */
+#define ECE391_IOFBF       2   /* fully buffered */
+
+typedef struct ece391_file_t {
+    int32_t in_use;
+    int32_t fd;
+    int32_t mode;
+    uint32_t out_len;          /* bytes waiting to be written */
+    uint32_t in_pos;           /* next byte of buffered input */
+    uint32_t in_len;           /* bytes of buffered input */
+    uint8_t buf[ECE391_BUFSIZ];
+} ece391_file_t;
+
+extern ece391_file_t* const ece391_stdin;
+extern ece391_file_t* const ece391_stdout;
+
+extern void ece391_stdio_init(void);
+extern ece391_file_t* ece391_fdopen(int32_t fd, int32_t mode);
+extern int32_t ece391_fclose(ece391_file_t* f);
+extern int32_t ece391_setvbuf(ece391_file_t* f, int32_t mode);
+extern int32_t ece391_fwrite(const void* buf, uint32_t n, ece391_file_t* f);
+extern int32_t ece391_fputs(const uint8_t* s, ece391_file_t* f);
+extern int32_t ece391_fputc(uint8_t c, ece391_file_t* f);
+extern int32_t ece391_fflush(ece391_file_t* f);
+extern void ece391_fflush_all(void);
+extern int32_t ece391_fread(void* buf, uint32_t n, ece391_file_t* f);
+extern int32_t ece391_fgets(uint8_t* s, int32_t n, ece391_file_t* f);
+
 #endif /* ECE391SUPPORT_H */
 
@@ -0,0 +1,154 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define ITERATIONS 10000
+#define BUFSIZE 16
+
+/* file and pattern the two ways grep has printed matches are run over */
+#define GREP_FILE "frame0.txt"
+#define GREP_PATTERN "o"
+#define GREP_BUFSIZE 1024
+
+/* write system calls made by the grep output cases */
+static int32_t write_calls;
+
+static uint64_t
+rdtsc (void)
+{
+    uint64_t val;
+    asm volatile ("rdtsc" : "=A" (val));
+    return val;
+}
+
+static void
+print_result (const char* name, uint64_t start, uint64_t end)
+{
+    uint8_t buf[BUFSIZE];
+
+    ece391_fdputs (1, (uint8_t*)name);
+    ece391_fdputs (1, ece391_itoa ((uint32_t)(end - start) / ITERATIONS, buf, 10));
+    ece391_fdputs (1, (uint8_t*)" cycles\n");
+}
+
+/* The write grep used to make for each part of a match, counted */
+static void
+counted_fdputs (const uint8_t* s)
+{
+    write_calls++;
+    (void)ece391_write (1, s, ece391_strlen (s));
+}
+
+/*
+ * Print every line of GREP_FILE containing GREP_PATTERN as "fname:line",
+ * with four writes per match as grep did before writev if use_writev is
+ * 0, and with one writev otherwise.  Returns the number of matches.
+ */
+static int32_t
+grep_output (int32_t use_writev)
+{
+    uint8_t data[GREP_BUFSIZE + 1];
+    ece391_iovec_t out[4];
+    int32_t fd, len, line_start, line_end, check, matches;
+    uint32_t s_len = ece391_strlen ((uint8_t*)GREP_PATTERN);
+
+    if (-1 == (fd = ece391_open ((uint8_t*)GREP_FILE)))
+        return 0;
+    len = ece391_read (fd, data, GREP_BUFSIZE);
+    (void)ece391_close (fd);
+    if (len <= 0)
+        return 0;
+
+    out[0].base = GREP_FILE;
+    out[0].len = ece391_strlen ((uint8_t*)GREP_FILE);
+    out[1].base = ":";
+    out[1].len = 1;
+    out[3].base = "\n";
+    out[3].len = 1;
+
+    matches = 0;
+    for (line_start = 0; line_start < len; line_start = line_end + 1) {
+        for (line_end = line_start; line_end < len && '\n' != data[line_end]; line_end++);
+        data[line_end] = '\0';
+        for (check = line_start; check + s_len <= line_end; check++) {
+            if (0 == ece391_strncmp (data + check, (uint8_t*)GREP_PATTERN, s_len))
+                break;
+        }
+        if (check + s_len > line_end)
+            continue;
+        matches++;
+        if (use_writev) {
+            out[2].base = data + line_start;
+            out[2].len = line_end - line_start;
+            write_calls++;
+            (void)ece391_writev (1, out, 4);
+        } else {
+            counted_fdputs ((uint8_t*)GREP_FILE);
+            counted_fdputs ((uint8_t*)":");
+            counted_fdputs (data + line_start);
+            counted_fdputs ((uint8_t*)"\n");
+        }
+    }
+    return matches;
+}
+
+static void
+print_writes (const char* name, int32_t matches)
+{
+    uint8_t buf[BUFSIZE];
+
+    ece391_fdputs (1, (uint8_t*)name);
+    ece391_fdputs (1, ece391_itoa ((uint32_t)write_calls, buf, 10));
+    ece391_fdputs (1, (uint8_t*)" writes for ");
+    ece391_fdputs (1, ece391_itoa ((uint32_t)matches, buf, 10));
+    ece391_fdputs (1, (uint8_t*)" matches\n");
+}
+
+/*
+ * Times a null system call (sigreturn, which the kernel turns straight
+ * around) entering the kernel through SYSENTER and through INT 0x80, then
+ * an empty write to stdout, which also goes through the file descriptor
+ * lookup and the driver's write function.  Then counts the write system
+ * calls grep's output takes per matching line, before and after writev.
+ */
+int main ()
+{
+    uint64_t start, end;
+    uint8_t buf[1];
+    int32_t i, matches;
+
+    start = rdtsc ();
+    for (i = 0; i < ITERATIONS; i++)
+        ece391_int80_sigreturn ();
+    end = rdtsc ();
+    print_result ("null syscall, int 0x80: ", start, end);
+
+    start = rdtsc ();
+    for (i = 0; i < ITERATIONS; i++)
+        ece391_sigreturn ();
+    end = rdtsc ();
+    print_result ("null syscall, sysenter: ", start, end);
+
+    start = rdtsc ();
+    for (i = 0; i < ITERATIONS; i++)
+        ece391_int80_write (1, buf, 0);
+    end = rdtsc ();
+    print_result ("empty write, int 0x80: ", start, end);
+
+    start = rdtsc ();
+    for (i = 0; i < ITERATIONS; i++)
+        ece391_write (1, buf, 0);
+    end = rdtsc ();
+    print_result ("empty write, sysenter: ", start, end);
+
+    write_calls = 0;
+    matches = grep_output (0);
+    print_writes ("grep output, fdputs: ", matches);
+
+    write_calls = 0;
+    matches = grep_output (1);
+    print_writes ("grep output, writev: ", matches);
+
+    return 0;
+}
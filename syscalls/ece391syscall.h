@@ -5,6 +5,12 @@
 
 /* All calls return >= 0 on success or -1 on failure. */
 
+/* One buffer of a readv or writev call; at most 16 per call. */
+typedef struct ece391_iovec_t {
+    void* base;
+    uint32_t len;
+} ece391_iovec_t;
+
 /*  
  * Note that the system call for halt will have to make sure that only
  * the low byte of EBX (the status argument) is returned to the calling
@@ -22,6 +28,39 @@ extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
 
+/*
+ * Vectored read and write: fill or write out each buffer in turn with a
+ * single call, and return the total number of bytes.  readv stops at the
+ * first buffer that isn't filled completely.
+ */
+extern int32_t ece391_readv (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+extern int32_t ece391_writev (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+
+/*
+ * Grow the heap by increment bytes (shrink it if negative) and return
+ * where the new memory starts, or (void*)-1 on failure.  New memory is
+ * zero-filled.
+ */
+extern void* ece391_sbrk (int32_t increment);
+
+/*
+ * The calls above enter the kernel with SYSENTER.  These go through
+ * INT 0x80 instead, as the calls above used to.
+ */
+extern int32_t ece391_int80_halt (uint8_t status);
+extern int32_t ece391_int80_execute (const uint8_t* command);
+extern int32_t ece391_int80_read (int32_t fd, void* buf, int32_t nbytes);
+extern int32_t ece391_int80_write (int32_t fd, const void* buf, int32_t nbytes);
+extern int32_t ece391_int80_open (const uint8_t* filename);
+extern int32_t ece391_int80_close (int32_t fd);
+extern int32_t ece391_int80_getargs (uint8_t* buf, int32_t nbytes);
+extern int32_t ece391_int80_vidmap (uint8_t** screen_start);
+extern int32_t ece391_int80_set_handler (int32_t signum, void* handler);
+extern int32_t ece391_int80_sigreturn (void);
+extern int32_t ece391_int80_readv (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+extern int32_t ece391_int80_writev (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+extern void* ece391_int80_sbrk (int32_t increment);
+
 enum signums {
 	DIV_ZERO = 0,
 	SEGFAULT,
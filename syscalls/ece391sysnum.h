@@ -11,5 +11,8 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_READV   11
+#define SYS_WRITEV  12
+#define SYS_SBRK    13
 
 #endif /* ECE391SYSNUM_H */
@@ -6,7 +6,7 @@
 int main ()
 {
 
-    ece391_fdputs (1, (uint8_t*)"Hello, if this ran, the program was correct. Yay!\n");
+    ece391_fputs ((uint8_t*)"Hello, if this ran, the program was correct. Yay!\n", ece391_stdout);
 
     return 0;
 }